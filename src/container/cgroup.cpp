@@ -0,0 +1,628 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "cgroup.h"
+
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#include "util/filesystem.h"
+#include "util/logger.h"
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+namespace linglong {
+
+static const char *const kFileNames[Cgroup::kFileCount] = {
+    "cgroup.procs", "cpu.max", "cpu.weight", "memory.max", "memory.high", "memory.low", "memory.swap.max", "pids.max",
+    "io.weight",    "io.max",  "io.latency", "cgroup.freeze",
+};
+
+static const char *const kStatFileNames[Cgroup::kStatFileCount] = {
+    "cpu.stat",     "memory.current", "memory.peak",   "memory.stat",
+    "io.stat",      "pids.current",   "memory.events", "cgroup.events",
+};
+
+static const char *const kPressureFileNames[Cgroup::kPressureCount] = {
+    "cpu.pressure",
+    "memory.pressure",
+    "io.pressure",
+};
+
+static const char *const kControllers[] = {"cpu", "memory", "pids", "io"};
+
+static const char *kCgroupRoot = "/sys/fs/cgroup";
+// the cgroup2 hierarchy of hybrid mode
+static const char *kCgroupUnifiedRoot = "/sys/fs/cgroup/unified";
+
+static bool IsCgroup2(const char *path)
+{
+    struct statfs st {
+    };
+    return 0 == statfs(path, &st) && st.f_type == CGROUP2_SUPER_MAGIC;
+}
+
+// root of the cgroup2 hierarchy, nullptr if it's not mounted
+static const char *Cgroup2Root()
+{
+    if (IsCgroup2(kCgroupRoot)) {
+        return kCgroupRoot;
+    }
+    return IsCgroup2(kCgroupUnifiedRoot) ? kCgroupUnifiedRoot : nullptr;
+}
+
+// path of the cgroup pid runs in, relative to the root of cgroup2
+static std::string CgroupOf(const std::string &pid)
+{
+    std::ifstream file("/proc/" + pid + "/cgroup");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            return line.substr(3);
+        }
+    }
+    return "";
+}
+
+static std::string ReadFile(const std::string &path)
+{
+    std::ifstream file(path);
+    std::string content;
+    std::getline(file, content);
+    return content;
+}
+
+static std::string MaxOr(int64_t value)
+{
+    return value > 0 ? std::to_string(value) : "max";
+}
+
+static std::string Device(int64_t major, int64_t minor)
+{
+    return std::to_string(major) + ":" + std::to_string(minor);
+}
+
+// call fn with each "key value" of a flat keyed file, or each "key=value" of a nested keyed file like io.stat
+template<typename Fn>
+static void ForEachKey(const char *data, char sep, Fn fn)
+{
+    const char *p = data;
+    while (*p) {
+        const char *key = p;
+        while (*p && *p != sep && *p != ' ' && *p != '\n') {
+            p++;
+        }
+        size_t keySize = p - key;
+        if (*p == sep) {
+            fn(key, keySize, strtoull(p + 1, const_cast<char **>(&p), 10));
+        }
+        while (*p && *p != ' ' && *p != '\n') {
+            p++;
+        }
+        while (*p == ' ' || *p == '\n') {
+            p++;
+        }
+    }
+}
+
+static bool KeyIs(const char *key, size_t size, const char *expected)
+{
+    return strlen(expected) == size && 0 == strncmp(key, expected, size);
+}
+
+struct CgroupPrivate {
+    std::string path;
+    int dirFd = -1;
+    int files[Cgroup::kFileCount];
+    int statFiles[Cgroup::kStatFileCount];
+    int pressureFiles[Cgroup::kPressureCount];
+    // do not remove a cgroup we didn't create
+    bool created = false;
+
+    CgroupPrivate()
+    {
+        std::fill(std::begin(files), std::end(files), -1);
+        std::fill(std::begin(statFiles), std::end(statFiles), -1);
+        std::fill(std::begin(pressureFiles), std::end(pressureFiles), -1);
+    }
+
+    void Close()
+    {
+        for (auto &fd : files) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        for (auto &fd : statFiles) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        for (auto &fd : pressureFiles) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (dirFd >= 0) {
+            close(dirFd);
+            dirFd = -1;
+        }
+    }
+
+    int OpenDir(const std::string &dir)
+    {
+        path = dir;
+        dirFd = open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            logErr() << "open cgroup" << path << "failed" << util::errnoString();
+            return -1;
+        }
+
+        for (int i = 0; i < Cgroup::kFileCount; i++) {
+            // a file is missing if its controller is not enabled
+            files[i] = openat(dirFd, kFileNames[i], O_WRONLY | O_CLOEXEC);
+            if (files[i] < 0) {
+                logDbg() << "open" << kFileNames[i] << "failed" << util::errnoString();
+            }
+        }
+
+        for (int i = 0; i < Cgroup::kStatFileCount; i++) {
+            statFiles[i] = openat(dirFd, kStatFileNames[i], O_RDONLY | O_CLOEXEC);
+        }
+
+        logDbg() << "cgroup" << path << "opened";
+        return 0;
+    }
+
+    // read a stat file into buf as a string, return false if it's not available
+    bool ReadStat(Cgroup::StatFile file, char *buf, size_t size) const
+    {
+        int fd = statFiles[file];
+        if (fd < 0) {
+            return false;
+        }
+        auto ret = pread(fd, buf, size - 1, 0);
+        if (ret < 0) {
+            return false;
+        }
+        buf[ret] = '\0';
+        return true;
+    }
+
+    // enable our controllers in the parent, so that they show up in the cgroup
+    static void EnableControllers(const util::fs::path &parent)
+    {
+        auto available = util::str_spilt(ReadFile((parent / "cgroup.controllers").string()), " ");
+        auto enabled = util::str_spilt(ReadFile((parent / "cgroup.subtree_control").string()), " ");
+
+        for (auto controller : kControllers) {
+            if (std::find(available.begin(), available.end(), controller) == available.end()
+                || std::find(enabled.begin(), enabled.end(), controller) != enabled.end()) {
+                continue;
+            }
+            // one by one, a controller which can't be enabled should not stop others
+            std::ofstream subtreeControl((parent / "cgroup.subtree_control").string());
+            subtreeControl << "+" << controller << std::endl;
+            if (!subtreeControl) {
+                logWan() << "enable controller" << controller << "in" << parent.string() << "failed"
+                         << util::errnoString();
+            }
+        }
+    }
+};
+
+Cgroup::Cgroup()
+    : dd_ptr(new CgroupPrivate)
+{
+}
+
+Cgroup::~Cgroup()
+{
+    dd_ptr->Close();
+}
+
+int Cgroup::Open(const std::string &cgroupsPath)
+{
+    const char *root = Cgroup2Root();
+    if (root == nullptr) {
+        logWan() << "cgroup v2 is not mounted";
+        return -1;
+    }
+
+    auto path = util::fs::path(root);
+    if (cgroupsPath.empty() || cgroupsPath[0] != '/') {
+        auto self = util::fs::path(CgroupOf("self"));
+        if (!self.components().empty()) {
+            path = path / self.parent_path().string();
+        }
+    }
+    path = path / cgroupsPath;
+
+    CgroupPrivate::EnableControllers(path.parent_path());
+
+    if (0 == mkdir(path.string().c_str(), 0755)) {
+        dd_ptr->created = true;
+    } else if (errno != EEXIST) {
+        logErr() << "create cgroup" << path.string() << "failed" << util::errnoString();
+        return -1;
+    }
+
+    return dd_ptr->OpenDir(path.string());
+}
+
+int Cgroup::Attach(pid_t pid)
+{
+    const char *root = Cgroup2Root();
+    auto cgroup = CgroupOf(std::to_string(pid));
+    if (root == nullptr || cgroup.empty()) {
+        logErr() << "no cgroup v2 of" << pid;
+        return -1;
+    }
+
+    return dd_ptr->OpenDir((util::fs::path(root) / cgroup).string());
+}
+
+int Cgroup::CreateChild(const std::string &name, Cgroup &child) const
+{
+    if (dd_ptr->dirFd < 0) {
+        return -1;
+    }
+
+    if (0 == mkdirat(dd_ptr->dirFd, name.c_str(), 0755)) {
+        child.dd_ptr->created = true;
+    } else if (errno != EEXIST) {
+        logErr() << "create cgroup" << name << "in" << dd_ptr->path << "failed" << util::errnoString();
+        return -1;
+    }
+
+    return child.dd_ptr->OpenDir(dd_ptr->path + "/" + name);
+}
+
+int Cgroup::Fd() const
+{
+    return dd_ptr->dirFd;
+}
+
+const std::string &Cgroup::Path() const
+{
+    return dd_ptr->path;
+}
+
+int Cgroup::Apply(const Resources &res)
+{
+    int ret = ApplyMemory(res.memory);
+    ret |= ApplyCPU(res.cpu);
+    ret |= ApplyPids(res.pids);
+    ret |= ApplyBlockIO(res.blockIO);
+    return ret;
+}
+
+int Cgroup::ApplyMemory(const ResourceMemory &memory)
+{
+    // swap of oci is the limit of memory and swap together
+    auto swapMax = (memory.swap > 0 && memory.limit > 0)
+                       ? std::to_string(std::max<int64_t>(memory.swap - memory.limit, 0))
+                       : "max";
+
+    int ret = Write(kMemoryMax, MaxOr(memory.limit));
+    ret |= Write(kMemoryHigh, MaxOr(memory.high));
+    ret |= Write(kMemoryLow, std::to_string(std::max<int64_t>(memory.reservation, 0)));
+    ret |= Write(kMemorySwapMax, swapMax);
+    return ret;
+}
+
+int Cgroup::ApplyCPU(const ResourceCPU &cpu)
+{
+    int ret = Write(kCpuMax, MaxOr(cpu.quota) + " " + std::to_string(cpu.period));
+    ret |= Write(kCpuWeight, std::to_string(CpuWeight(cpu.shares)));
+    return ret;
+}
+
+int Cgroup::ApplyPids(const ResourcePids &pids)
+{
+    return Write(kPidsMax, MaxOr(pids.limit));
+}
+
+int Cgroup::Update(const nlohmann::json &resources)
+{
+    int ret = 0;
+    if (resources.count("memory")) {
+        auto const &memory = resources.at("memory");
+        if (memory.count("limit")) {
+            ret |= Write(kMemoryMax, MaxOr(memory.at("limit").get<int64_t>()));
+        }
+        if (memory.count("high")) {
+            ret |= Write(kMemoryHigh, MaxOr(memory.at("high").get<int64_t>()));
+        }
+        if (memory.count("reservation")) {
+            ret |= Write(kMemoryLow, std::to_string(std::max<int64_t>(memory.at("reservation").get<int64_t>(), 0)));
+        }
+        if (memory.count("swap")) {
+            // swap of oci includes the memory limit, which is the one in effect if not given
+            auto swap = memory.at("swap").get<int64_t>();
+            auto limit = memory.count("limit") ? memory.at("limit").get<int64_t>()
+                                               : strtoll(ReadFile(dd_ptr->path + "/memory.max").c_str(), nullptr, 10);
+            ret |= Write(kMemorySwapMax,
+                         (swap > 0 && limit > 0) ? std::to_string(std::max<int64_t>(swap - limit, 0)) : "max");
+        }
+    }
+
+    if (resources.count("cpu")) {
+        auto const &cpu = resources.at("cpu");
+        if (cpu.count("period")) {
+            // cpu.max takes the quota first, keep the one in effect if not given
+            auto quota = ReadFile(dd_ptr->path + "/cpu.max");
+            quota = cpu.count("quota") ? MaxOr(cpu.at("quota").get<int64_t>()) : quota.substr(0, quota.find(' '));
+            ret |= Write(kCpuMax, quota + " " + std::to_string(cpu.at("period").get<uint64_t>()));
+        } else if (cpu.count("quota")) {
+            // the period is kept without the second field
+            ret |= Write(kCpuMax, MaxOr(cpu.at("quota").get<int64_t>()));
+        }
+        if (cpu.count("shares")) {
+            ret |= Write(kCpuWeight, std::to_string(CpuWeight(cpu.at("shares").get<uint64_t>())));
+        }
+    }
+
+    if (resources.count("pids") && resources.at("pids").count("limit")) {
+        ret |= ApplyPids(resources.at("pids").get<ResourcePids>());
+    }
+
+    // nothing is written for the keys not present
+    if (resources.count("blockIO")) {
+        ret |= ApplyBlockIO(resources.at("blockIO").get<ResourceBlockIO>());
+    }
+    return ret;
+}
+
+int Cgroup::ApplyBlockIO(const ResourceBlockIO &blockIO)
+{
+    int ret = 0;
+    if (blockIO.weight > 0) {
+        ret |= Write(kIoWeight, "default " + std::to_string(IoWeight(blockIO.weight)));
+    }
+    for (const auto &device : blockIO.weightDevice) {
+        ret |= Write(kIoWeight, Device(device.major, device.minor) + " " + std::to_string(IoWeight(device.weight)));
+    }
+
+    // io.max takes one line per write, all limits of a device are in the same line
+    std::map<std::string, std::string> limits;
+    const std::pair<const char *, const std::vector<BlockIOThrottleDevice> *> throttles[] = {
+        {"rbps", &blockIO.throttleReadBpsDevice},
+        {"wbps", &blockIO.throttleWriteBpsDevice},
+        {"riops", &blockIO.throttleReadIOPSDevice},
+        {"wiops", &blockIO.throttleWriteIOPSDevice},
+    };
+    for (const auto &throttle : throttles) {
+        for (const auto &device : *throttle.second) {
+            limits[Device(device.major, device.minor)] +=
+                util::format(" %s=%s", throttle.first, MaxOr(static_cast<int64_t>(device.rate)).c_str());
+        }
+    }
+    for (const auto &limit : limits) {
+        ret |= Write(kIoMax, limit.first + limit.second);
+    }
+
+    for (const auto &device : blockIO.latencyDevice) {
+        ret |= Write(kIoLatency,
+                     Device(device.major, device.minor) + " target=" + MaxOr(static_cast<int64_t>(device.target)));
+    }
+    return ret;
+}
+
+int Cgroup::Write(File file, const std::string &value) const
+{
+    // the controller is not available, it's not an error
+    int fd = dd_ptr->files[file];
+    if (fd < 0) {
+        return 0;
+    }
+
+    if (write(fd, value.c_str(), value.size()) != static_cast<ssize_t>(value.size())) {
+        logWan() << "write" << value << "to" << kFileNames[file] << "failed" << util::errnoString();
+        return -1;
+    }
+    logDbg() << "write" << value << "to" << kFileNames[file];
+    return 0;
+}
+
+int Cgroup::ReadStats(CgroupStats &stats) const
+{
+    if (dd_ptr->dirFd < 0) {
+        return -1;
+    }
+
+    // memory.stat is the largest, about 1.5k
+    char buf[8192];
+    stats = CgroupStats();
+
+    if (dd_ptr->ReadStat(kCpuStat, buf, sizeof(buf))) {
+        ForEachKey(buf, ' ', [&](const char *key, size_t size, uint64_t value) {
+            if (KeyIs(key, size, "usage_usec")) {
+                stats.cpuUsage = value;
+            } else if (KeyIs(key, size, "user_usec")) {
+                stats.cpuUser = value;
+            } else if (KeyIs(key, size, "system_usec")) {
+                stats.cpuSystem = value;
+            }
+        });
+    }
+    if (dd_ptr->ReadStat(kMemoryCurrent, buf, sizeof(buf))) {
+        stats.memoryCurrent = strtoull(buf, nullptr, 10);
+    }
+    if (dd_ptr->ReadStat(kMemoryPeak, buf, sizeof(buf))) {
+        stats.memoryPeak = strtoull(buf, nullptr, 10);
+    }
+    if (dd_ptr->ReadStat(kMemoryStat, buf, sizeof(buf))) {
+        ForEachKey(buf, ' ', [&](const char *key, size_t size, uint64_t value) {
+            if (KeyIs(key, size, "pgfault")) {
+                stats.pageFaults = value;
+            } else if (KeyIs(key, size, "pgmajfault")) {
+                stats.majorPageFaults = value;
+            }
+        });
+    }
+    if (dd_ptr->ReadStat(kIoStat, buf, sizeof(buf))) {
+        // "8:0 rbytes=1 wbytes=2 rios=3 ...", one line per device
+        ForEachKey(buf, '=', [&](const char *key, size_t size, uint64_t value) {
+            if (KeyIs(key, size, "rbytes")) {
+                stats.ioReadBytes += value;
+            } else if (KeyIs(key, size, "wbytes")) {
+                stats.ioWriteBytes += value;
+            }
+        });
+    }
+    if (dd_ptr->ReadStat(kPidsCurrent, buf, sizeof(buf))) {
+        stats.pids = strtoull(buf, nullptr, 10);
+    }
+    return 0;
+}
+
+int Cgroup::ReadMemoryEvents(CgroupMemoryEvents &events) const
+{
+    char buf[256];
+    if (!dd_ptr->ReadStat(kMemoryEvents, buf, sizeof(buf))) {
+        return -1;
+    }
+
+    events = CgroupMemoryEvents();
+    ForEachKey(buf, ' ', [&](const char *key, size_t size, uint64_t value) {
+        if (KeyIs(key, size, "low")) {
+            events.low = value;
+        } else if (KeyIs(key, size, "high")) {
+            events.high = value;
+        } else if (KeyIs(key, size, "max")) {
+            events.max = value;
+        } else if (KeyIs(key, size, "oom")) {
+            events.oom = value;
+        } else if (KeyIs(key, size, "oom_kill")) {
+            events.oomKill = value;
+        }
+    });
+    return 0;
+}
+
+int Cgroup::StatFd(StatFile file) const
+{
+    return dd_ptr->statFiles[file];
+}
+
+int Cgroup::AddPressureTrigger(Pressure resource, const std::string &trigger)
+{
+    if (dd_ptr->dirFd < 0) {
+        return -1;
+    }
+
+    // a trigger lives as long as its fd, one per file
+    auto &fd = dd_ptr->pressureFiles[resource];
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = openat(dd_ptr->dirFd, kPressureFileNames[resource], O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        logWan() << "open" << kPressureFileNames[resource] << "failed" << util::errnoString();
+        return -1;
+    }
+
+    // the trigger string must be written with its terminating '\0'
+    if (write(fd, trigger.c_str(), trigger.size() + 1) < 0) {
+        logWan() << "add trigger" << trigger << "to" << kPressureFileNames[resource] << "failed"
+                 << util::errnoString();
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+    logDbg() << "add trigger" << trigger << "to" << kPressureFileNames[resource];
+    return fd;
+}
+
+std::string Cgroup::ReadPressure(Pressure resource) const
+{
+    char buf[256];
+    int fd = dd_ptr->pressureFiles[resource];
+    auto ret = fd < 0 ? -1 : pread(fd, buf, sizeof(buf) - 1, 0);
+    if (ret < 0) {
+        return "";
+    }
+    buf[ret] = '\0';
+    return buf;
+}
+
+int Cgroup::Freeze(bool frozen) const
+{
+    return dd_ptr->files[kFreeze] < 0 ? -1 : Write(kFreeze, frozen ? "1" : "0");
+}
+
+int Cgroup::Frozen() const
+{
+    char buf[128];
+    if (!dd_ptr->ReadStat(kEvents, buf, sizeof(buf))) {
+        return -1;
+    }
+
+    int frozen = -1;
+    ForEachKey(buf, ' ', [&](const char *key, size_t size, uint64_t value) {
+        if (KeyIs(key, size, "frozen")) {
+            frozen = value ? 1 : 0;
+        }
+    });
+    return frozen;
+}
+
+void Cgroup::Remove()
+{
+    dd_ptr->Close();
+    if (!dd_ptr->created) {
+        return;
+    }
+
+    // processes of the pid namespace are released by the kernel asynchronously after init is reaped
+    for (int i = 0; i < 10; i++) {
+        if (0 == rmdir(dd_ptr->path.c_str()) || errno != EBUSY) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (util::fs::exists(dd_ptr->path)) {
+        logWan() << "remove cgroup" << dd_ptr->path << "failed" << util::errnoString();
+    }
+    dd_ptr->created = false;
+}
+
+uint64_t Cgroup::IoWeight(uint64_t weight)
+{
+    weight = std::max<uint64_t>(std::min<uint64_t>(weight, 1000), 10);
+    return 1 + (weight - 10) * 9999 / 990;
+}
+
+uint64_t Cgroup::CpuWeight(uint64_t shares)
+{
+    if (shares < 2) {
+        return 100;
+    }
+    // the quadratic conversion of crun, it maps 2, 1024 and 262144 to 1, 100 and 10000
+    double l = std::log2(static_cast<double>(std::min<uint64_t>(shares, 262144)));
+    double exponent = (l * l + 125 * l) / 612.0 - 7.0 / 34.0;
+    return static_cast<uint64_t>(std::ceil(std::pow(10, exponent)));
+}
+
+} // namespace linglong
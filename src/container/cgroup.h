@@ -0,0 +1,157 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_CONTAINER_CGROUP_H_
+#define LINGLONG_BOX_SRC_CONTAINER_CGROUP_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "util/oci_runtime.h"
+
+namespace linglong {
+
+struct CgroupPrivate;
+
+// counters are accumulated since the cgroup is created, the others are current values
+struct CgroupStats {
+    // cpu.stat, in microseconds
+    uint64_t cpuUsage = 0;
+    uint64_t cpuUser = 0;
+    uint64_t cpuSystem = 0;
+    // memory.current and memory.peak (linux 5.19), in bytes
+    uint64_t memoryCurrent = 0;
+    uint64_t memoryPeak = 0;
+    // pgfault and pgmajfault of memory.stat
+    uint64_t pageFaults = 0;
+    uint64_t majorPageFaults = 0;
+    // io.stat of all devices
+    uint64_t ioReadBytes = 0;
+    uint64_t ioWriteBytes = 0;
+    // pids.current
+    uint64_t pids = 0;
+};
+
+// memory.events, counts of each event since the cgroup is created
+struct CgroupMemoryEvents {
+    uint64_t low = 0;
+    uint64_t high = 0;
+    uint64_t max = 0;
+    uint64_t oom = 0;
+    uint64_t oomKill = 0;
+};
+
+/*!
+ * Cgroup is the cgroup v2 directory of a container, init is cloned into it.
+ *
+ * An absolute cgroupsPath is taken from the root of the cgroup2 hierarchy, a relative one from the parent of the cgroup
+ * ll-box runs in, which is where a session manager delegates cgroups to the user. Controllers are enabled in the
+ * parent if they are not yet.
+ *
+ * Control and stat files are opened once, so applying a value later is a single write on a fd kept open, and reading
+ * stats costs a pread per file.
+ */
+class Cgroup
+{
+public:
+    enum File {
+        kProcs,
+        kCpuMax,
+        kCpuWeight,
+        kMemoryMax,
+        kMemoryHigh,
+        kMemoryLow,
+        kMemorySwapMax,
+        kPidsMax,
+        kIoWeight,
+        kIoMax,
+        kIoLatency,
+        kFreeze,
+        kFileCount,
+    };
+
+    enum StatFile {
+        kCpuStat,
+        kMemoryCurrent,
+        kMemoryPeak,
+        kMemoryStat,
+        kIoStat,
+        kPidsCurrent,
+        // gets EPOLLPRI when it changes
+        kMemoryEvents,
+        // populated and frozen, gets EPOLLPRI when it changes
+        kEvents,
+        kStatFileCount,
+    };
+
+    enum Pressure {
+        kCpuPressure,
+        kMemoryPressure,
+        kIoPressure,
+        kPressureCount,
+    };
+
+    Cgroup();
+    ~Cgroup();
+
+    // create the cgroup if not exist and open its control files
+    int Open(const std::string &cgroupsPath);
+    // open the cgroup pid runs in, to change a running container
+    int Attach(pid_t pid);
+    // create a child cgroup if not exist and open it as child
+    int CreateChild(const std::string &name, Cgroup &child) const;
+
+    // fd of the cgroup directory, -1 if not opened
+    int Fd() const;
+    const std::string &Path() const;
+
+    int Apply(const Resources &res);
+    int ApplyMemory(const ResourceMemory &memory);
+    int ApplyCPU(const ResourceCPU &cpu);
+    int ApplyPids(const ResourcePids &pids);
+    int ApplyBlockIO(const ResourceBlockIO &blockIO);
+    // apply linux.resources of oci to a running cgroup, only the keys present are written and others keep their
+    // values, where Apply writes the defaults of Resources for them
+    int Update(const nlohmann::json &resources);
+
+    // write is skipped if file is missing, which means its controller is not available
+    int Write(File file, const std::string &value) const;
+
+    // read stat files opened with the cgroup, stats of a controller not available are 0
+    int ReadStats(CgroupStats &stats) const;
+    int ReadMemoryEvents(CgroupMemoryEvents &events) const;
+    // fd of a stat file for epoll, -1 if it's not available
+    int StatFd(StatFile file) const;
+
+    // register a psi trigger such as "some 150000 1000000", see Documentation/accounting/psi.rst of linux. Return a fd
+    // which gets EPOLLPRI when the trigger fires, it's owned by Cgroup.
+    int AddPressureTrigger(Pressure resource, const std::string &trigger);
+    // content of the pressure file, "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" and a "full" line
+    std::string ReadPressure(Pressure resource) const;
+
+    // request to freeze or thaw the cgroup, it's done when Frozen() returns the same state
+    int Freeze(bool frozen) const;
+    // 1 if frozen, 0 if not, -1 if unknown
+    int Frozen() const;
+
+    // close all fds and remove the cgroup, it should be empty
+    void Remove();
+
+    // convert cgroup v1 cpu.shares [2-262144] to cgroup v2 cpu.weight [1-10000], 1024 is mapped to the default 100
+    static uint64_t CpuWeight(uint64_t shares);
+    // convert cgroup v1 blkio.weight [10-1000] to cgroup v2 io.weight [1-10000]
+    static uint64_t IoWeight(uint64_t weight);
+
+private:
+    std::unique_ptr<CgroupPrivate> dd_ptr;
+};
+
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_CONTAINER_CGROUP_H_ */
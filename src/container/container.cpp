@@ -15,31 +15,52 @@
 #include <sys/wait.h>
 #include <sys/signalfd.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <sched.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <utility>
 
 #include "util/logger.h"
 #include "util/filesystem.h"
+#include "util/metrics.h"
+#include "util/perf.h"
 #include "util/semaphore.h"
 #include "util/debug/debug.h"
 #include "util/platform.h"
+#include "util/probe.h"
+#include "util/runtime_cache.h"
+#include "util/trace.h"
+#include "util/trace_ring.h"
 
+#include "container/cgroup.h"
 #include "container/seccomp.h"
 #include "container/container_option.h"
+#include "container/exec.h"
 #include "container/mount/host_mount.h"
 #include "container/mount/filesystem_driver.h"
+#include "container/mount/mount_plan.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 namespace linglong {
 
+static const int kMaxEpollEvents = 64;
+
 static const std::string llDbusProxyBin = "/usr/bin/ll-dbus-proxy";
-// start dbus proxy
-static int StartDbusProxy(const Runtime &runtime)
+// ll-dbus-proxy writes one byte to this fd when the socket is listening, the pipe is closed if it exits.
+static const char *llDbusProxyReadyFdEnv = "LINGLONG_DBUS_PROXY_READY_FD";
+// start dbus proxy, readyFd is for WaitDbusProxy
+static int StartDbusProxy(const Runtime &runtime, int &readyFd)
 {
     if (!(runtime.annotations.has_value() && runtime.annotations->dbus_proxy_info.has_value()
           && runtime.annotations->dbus_proxy_info->enable)) {
@@ -51,15 +72,27 @@ static int StartDbusProxy(const Runtime &runtime)
 
     std::string socket_path = info->proxy_path;
 
+    int ready[2];
+    if (0 != pipe2(ready, O_CLOEXEC)) {
+        logErr() << "pipe2 failed" << util::errnoString();
+        return -1;
+    }
+
     pid_t proxy_pid = fork();
     if (proxy_pid < 0) {
-        logErr() << "fork to start dbus proxy failed:", util::errnoString();
+        logErr() << "fork to start dbus proxy failed:" << util::errnoString();
+        close(ready[0]);
+        close(ready[1]);
         return -1;
     }
 
     if (0 == proxy_pid) {
         // FIXME: parent may dead before this return.
         prctl(PR_SET_PDEATHSIG, SIGKILL);
+        close(ready[0]);
+        fcntl(ready[1], F_SETFD, 0);
+        setenv(llDbusProxyReadyFdEnv, std::to_string(ready[1]).c_str(), 1);
+
         std::string bus_type = info->bus_type;
         std::string app_id = info->app_id;
         std::vector<std::string> name_fliter = info->name;
@@ -76,19 +109,36 @@ static int StartDbusProxy(const Runtime &runtime)
                                     path_fliter_string.c_str(),
                                     interface_fliter_string.c_str(),
                                     NULL};
+        util::Logger::Flush();
         int ret = execvp(args[0], (char **)args);
         logErr() << "start dbus proxy failed, ret=" << ret;
         exit(ret);
-    } else {
-        // FIXME: this call make 10ms lag at least
-        if (util::fs::path(socket_path).wait_until_exsit() != 0) {
-            logErr() << util::format("timeout! socketPath [\"%s\"] not exsit", socket_path.c_str());
-            return -1;
-        }
     }
+
+    close(ready[1]);
+    readyFd = ready[0];
     return 0;
 }
 
+// block until the dbus proxy listens on its socket, and close readyFd
+static int WaitDbusProxy(const std::string &socket_path, int readyFd)
+{
+    // a proxy which does not know the ready fd never writes it, then the socket creation is what we wait for.
+    int ret = util::fs::wait_until_exist(util::fs::path(socket_path), readyFd, 1000);
+    if (ret == 1) {
+        char c;
+        ret = (read(readyFd, &c, 1) == 1) ? 0 : -1;
+        if (ret != 0) {
+            logErr() << "dbus proxy exited before ready";
+        }
+    } else if (ret != 0) {
+        logErr() << util::format("timeout! socketPath [\"%s\"] not exsit", socket_path.c_str());
+    }
+    close(readyFd);
+
+    return ret;
+}
+
 int DropToNormalUser(int uid, int gid)
 {
     setuid(uid);
@@ -131,81 +181,125 @@ static int ConfigUserNamespace(const linglong::Linux &linux, int initPid)
     return 0;
 }
 
-// FIXME(iceyer): not work now
-static int ConfigCgroupV2(const std::string &cgroupsPath, const linglong::Resources &res, int initPid)
-{
-    if (cgroupsPath.empty()) {
-        logWan() << "skip with empty cgroupsPath";
-        return 0;
-    }
-
-    auto writeConfig = [](const std::map<std::string, std::string> &cfgs) {
-        for (auto const &cfg : cfgs) {
-            logWan() << "ConfigCgroupV2" << cfg.first << cfg.second;
-            std::ofstream cfgFile(cfg.first);
-            cfgFile << cfg.second << std::endl;
-            cfgFile.close();
-        }
-    };
+struct StatsField {
+    const char *name;
+    uint64_t CgroupStats::*value;
+    // accumulated since the cgroup is created
+    bool counter;
+};
 
-    auto cgroupsRoot = util::fs::path(cgroupsPath);
-    util::fs::create_directories(cgroupsRoot, 0755);
+static const StatsField kStatsFields[] = {
+    {"cpuUsage", &CgroupStats::cpuUsage, true},
+    {"cpuUser", &CgroupStats::cpuUser, true},
+    {"cpuSystem", &CgroupStats::cpuSystem, true},
+    {"memoryCurrent", &CgroupStats::memoryCurrent, false},
+    {"memoryPeak", &CgroupStats::memoryPeak, false},
+    {"pageFaults", &CgroupStats::pageFaults, true},
+    {"majorPageFaults", &CgroupStats::majorPageFaults, true},
+    {"ioReadBytes", &CgroupStats::ioReadBytes, true},
+    {"ioWriteBytes", &CgroupStats::ioWriteBytes, true},
+    {"pids", &CgroupStats::pids, false},
+};
 
-    int ret = mount("cgroup2", cgroupsRoot.string().c_str(), "cgroup2", 0u, nullptr);
-    if (ret != 0) {
-        logErr() << "mount cgroup failed" << util::RetErrString(ret);
-        return -1;
+// with last, counters are increments since last and a field which didn't change is left out, return an empty json if
+// nothing changed
+static nlohmann::json StatsMessage(const CgroupStats &stats, const CgroupStats *last)
+{
+    nlohmann::json message = {{"type", "stats"}, {"timestamp", util::trace::Now()}};
+    bool changed = false;
+    for (const auto &field : kStatsFields) {
+        auto value = stats.*field.value;
+        if (last) {
+            auto lastValue = (*last).*field.value;
+            if (value == lastValue) {
+                continue;
+            }
+            if (field.counter) {
+                value = value > lastValue ? value - lastValue : value;
+            }
+        }
+        message[field.name] = value;
+        changed = true;
     }
+    return changed ? message : nlohmann::json();
+}
 
-    // TODO: should sub path with pid?
-    auto subCgroupRoot = cgroupsRoot / "ll-box";
-    if (!util::fs::create_directories(util::fs::path(subCgroupRoot), 0755)) {
-        logErr() << "create_directories subCgroupRoot failed" << util::errnoString();
-        return -1;
+static const char *const kPressureNames[Cgroup::kPressureCount] = {"cpu", "memory", "io"};
+
+// content is lines like "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+static nlohmann::json PressureMessage(Cgroup::Pressure resource, const std::string &content)
+{
+    nlohmann::json message = {{"type", "pressure"}, {"resource", kPressureNames[resource]}};
+    for (const auto &line : util::str_spilt(content, "\n")) {
+        auto items = util::str_spilt(line, " ");
+        if (items.empty()) {
+            continue;
+        }
+        nlohmann::json values;
+        for (size_t i = 1; i < items.size(); i++) {
+            auto kv = util::str_spilt(items[i], "=");
+            if (kv.size() != 2) {
+                continue;
+            }
+            if (kv[0] == "total") {
+                values[kv[0]] = std::strtoull(kv[1].c_str(), nullptr, 10);
+            } else {
+                values[kv[0]] = std::strtod(kv[1].c_str(), nullptr);
+            }
+        }
+        message[items[0]] = values;
     }
+    return message;
+}
 
-    auto subCgroupPath = [subCgroupRoot](const std::string &compents) -> std::string {
-        return (subCgroupRoot / compents).string();
+// events which happened since last, empty if none
+static nlohmann::json MemoryEventsMessage(const CgroupMemoryEvents &events, const CgroupMemoryEvents &last)
+{
+    const std::pair<const char *, uint64_t CgroupMemoryEvents::*> fields[] = {
+        {"low", &CgroupMemoryEvents::low}, {"high", &CgroupMemoryEvents::high},
+        {"max", &CgroupMemoryEvents::max}, {"oom", &CgroupMemoryEvents::oom},
+        {"oomKill", &CgroupMemoryEvents::oomKill},
     };
 
-    // config memory
-    const auto memMax = res.memory.limit;
-
-    if (memMax > 0) {
-        const auto memSwapMax = res.memory.swap - memMax;
-        const auto memLow = res.memory.reservation;
-        writeConfig({
-            {subCgroupPath("memory.max"), util::format("%d", memMax)},
-            {subCgroupPath("memory.swap.max"), util::format("%d", memSwapMax)},
-            {subCgroupPath("memory.low"), util::format("%d", memLow)},
-        });
+    nlohmann::json message = {{"type", "memoryEvents"}};
+    bool changed = false;
+    for (const auto &field : fields) {
+        if (events.*field.second > last.*field.second) {
+            message[field.first] = events.*field.second - last.*field.second;
+            changed = true;
+        }
     }
+    return changed ? message : nlohmann::json();
+}
 
-    // config cpu
-    const auto cpuPeriod = res.cpu.period;
-    const auto cpuMax = res.cpu.quota;
-    // convert from [2-262144] to [1-10000], 262144 is 2^18
-    const auto cpuWeight = (1 + ((res.cpu.shares - 2) * 9999) / 262142);
-
-    writeConfig({
-        {subCgroupPath("cpu.max"), util::format("%d %d", cpuMax, cpuPeriod)},
-        {subCgroupPath("cpu.weight"), util::format("%d", cpuWeight)},
-    });
-
-    // config pid
-    writeConfig({
-        {subCgroupPath("cgroup.procs"), util::format("%d", initPid)},
-    });
+// clone init into cgroup. On kernels without CLONE_INTO_CGROUP, entry moves itself to the cgroup and init inherits it,
+// then a new cgroup namespace of init is rooted there as well. The same is done when clone3 is denied, by a seccomp
+// filter which fails it with EPERM, or with EACCES when the cgroup is not delegated to us.
+static int CloneInit(int (*callback)(void *), int flags, void *arg, const Cgroup *cgroup)
+{
+    if (cgroup == nullptr || cgroup->Fd() < 0) {
+        return util::PlatformClone(callback, flags, arg);
+    }
 
-    logDbg() << "move" << initPid << "to new cgroups";
+    int pid = util::PlatformClone3(callback, flags, arg, cgroup->Fd());
+    if (pid >= 0 || (errno != ENOSYS && errno != EPERM && errno != EACCES)) {
+        return pid;
+    }
 
-    return 0;
+    if (errno == ENOSYS) {
+        logDbg() << "clone3 into cgroup is not supported, move" << getpid() << "to" << cgroup->Path();
+    } else {
+        logWan() << "clone3 into cgroup" << cgroup->Path() << "failed" << util::errnoString() << ", move" << getpid()
+                 << "instead";
+    }
+    cgroup->Write(Cgroup::kProcs, std::to_string(getpid()));
+    return util::PlatformClone(callback, flags, arg);
 }
 
-inline void epoll_ctl_add(int epfd, int fd)
+inline void epoll_ctl_add(int epfd, int fd, uint32_t events = EPOLLIN)
 {
     static epoll_event ev = {};
-    ev.events = EPOLLIN;
+    ev.events = events;
     ev.data.fd = fd;
     int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
     if (ret != 0)
@@ -258,9 +352,57 @@ public:
 
     HostMount *containerMounter = nullptr;
 
+    // mounts of native rootfs, they are mounted by containerMounter with runtime.mounts
+    std::vector<Mount> rootfsMounts;
+
     std::unique_ptr<util::MessageReader> reader;
 
-    std::map<int, std::string> pidMap;
+    // runtime.process resolved against the mount plan before mounting, nullptr if it's deferred or not resolved
+    std::unique_ptr<util::SpawnArgs> processSpawn;
+
+    // opened on host with the permission of the user, nullptr if linux.cgroupsPath is empty
+    std::unique_ptr<Cgroup> cgroup;
+    // child "app" of cgroup where processes are born, it's frozen and thawed without init
+    std::unique_ptr<Cgroup> appCgroup;
+
+    // processes started by init, exits are reported to reader
+    struct ChildProcess {
+        pid_t pid;
+        // -1 if pidfd_open is not supported, the child is reaped on SIGCHLD then
+        int pidfd;
+        std::string name;
+        // connection of ExecInContainer which started it, -1 if it's started from reader
+        int execConn;
+    };
+    // nodes are stable, epoll events point to them
+    std::unordered_map<pid_t, ChildProcess> children;
+    bool processStarted = false;
+    int epfd = -1;
+
+    // socket of ExecInContainer, and connections waiting to send a process
+    int execFd = -1;
+    std::set<int> execConns;
+
+    // timerfd to publish cgroup stats to reader, see AnnotationsStats
+    int statsFd = -1;
+    CgroupStats lastStats;
+    bool statsSent = false;
+
+    // psi triggers and memory.events, see AnnotationsPressure. fds are owned by cgroup.
+    int pressureFds[Cgroup::kPressureCount] = {-1, -1, -1};
+    int memoryEventsFd = -1;
+    CgroupMemoryEvents lastMemoryEvents;
+
+    // cgroup.events of appCgroup, and the state requested by the last freeze or thaw, -1 if none is pending
+    int appEventsFd = -1;
+    int pendingFrozen = -1;
+
+    // the dbus proxy is started before cloning entry and awaited by entry just before mounting its socket
+    int dbusProxyReadyFd = -1;
+
+    // compiled on host where the cache is, installed by init
+    std::vector<struct sock_filter> seccompProgram;
+    bool seccompPrepared = false;
 
 public:
     static int DropPermissions()
@@ -344,6 +486,264 @@ public:
         return 0;
     }
 
+    // reap a tracked child and report its exit, return false if it's still running
+    bool ReapChild(ChildProcess &child)
+    {
+        int wstatus;
+        int ret = waitpid(child.pid, &wstatus, WNOHANG);
+        if (ret == 0) {
+            return false;
+        }
+        if (ret < 0) {
+            logWan() << util::format("waitpid %d failed, %s", child.pid, util::errnoString().c_str());
+        } else {
+            std::string info;
+            auto normal = parse_wstatus(wstatus, info);
+            info = util::format("child [%d] [%s].", child.pid, info.c_str());
+            if (normal) {
+                logDbg() << info;
+            } else {
+                logWan() << info;
+            }
+            util::trace::Record(util::trace::kChildExit, static_cast<uint64_t>(child.pid),
+                                static_cast<uint64_t>(wstatus));
+            util::metrics::Add(util::metrics::kChildrenExited);
+            if (reader.get() != nullptr)
+                reader->writeChildExit(child.pid, child.name, wstatus, info);
+            if (child.execConn >= 0) {
+                ReplyExec(child.execConn, wstatus);
+            }
+        }
+
+        if (child.execConn >= 0) {
+            close(child.execConn);
+        }
+
+        if (child.pidfd >= 0) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, child.pidfd, nullptr);
+            close(child.pidfd);
+        }
+        pid_t pid = child.pid;
+        children.erase(pid);
+        return true;
+    }
+
+    // reap exited children which are not watched by a pidfd: orphans reparented to us as pid 1, or children of a kernel
+    // without pidfd_open. The zombie is peeked with WNOWAIT so a tracked child is still reported by ReapChild.
+    void ReapUntracked()
+    {
+        for (;;) {
+            siginfo_t info = {};
+            if (0 != waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) || info.si_pid == 0) {
+                return;
+            }
+
+            auto it = children.find(info.si_pid);
+            if (it != children.end()) {
+                ReapChild(it->second);
+                continue;
+            }
+
+            int wstatus;
+            waitpid(info.si_pid, &wstatus, WNOHANG);
+            std::string str;
+            parse_wstatus(wstatus, str);
+            logDbg() << util::format("orphan [%d] [%s].", info.si_pid, str.c_str());
+        }
+    }
+
+    // true if there is no child left, running or not
+    static bool NoChild()
+    {
+        siginfo_t info = {};
+        return waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 && errno == ECHILD;
+    }
+
+    void WatchChild(ChildProcess &child)
+    {
+        if (child.pidfd < 0 || epfd < 0) {
+            return;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &child;
+        if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, child.pidfd, &ev)) {
+            logWan() << "watch child" << child.pid << "failed" << util::errnoString();
+        }
+    }
+
+    int StartStats()
+    {
+        if (!(runtime.annotations.has_value() && runtime.annotations->stats.has_value()
+              && runtime.annotations->stats->interval > 0 && cgroup && reader)) {
+            return -1;
+        }
+
+        auto interval = runtime.annotations->stats->interval;
+        struct itimerspec spec {
+        };
+        spec.it_interval.tv_sec = static_cast<time_t>(interval / 1000);
+        spec.it_interval.tv_nsec = static_cast<long>(interval % 1000) * 1000000;
+        spec.it_value = spec.it_interval;
+
+        statsFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (statsFd < 0 || 0 != timerfd_settime(statsFd, 0, &spec, nullptr)) {
+            logWan() << "start stats timer failed" << util::errnoString();
+            return -1;
+        }
+        epoll_ctl_add(epfd, statsFd);
+        logDbg() << "publish stats every" << interval << "ms";
+        return 0;
+    }
+
+    void StartPressure()
+    {
+        if (!(runtime.annotations.has_value() && runtime.annotations->pressure.has_value() && cgroup && reader)) {
+            return;
+        }
+
+        const auto &pressure = *runtime.annotations->pressure;
+        const tl::optional<std::string> *triggers[Cgroup::kPressureCount] = {&pressure.cpu, &pressure.memory,
+                                                                             &pressure.io};
+        for (int i = 0; i < Cgroup::kPressureCount; i++) {
+            if (!triggers[i]->has_value()) {
+                continue;
+            }
+            pressureFds[i] = cgroup->AddPressureTrigger(static_cast<Cgroup::Pressure>(i), triggers[i]->value());
+            if (pressureFds[i] >= 0) {
+                epoll_ctl_add(epfd, pressureFds[i], EPOLLPRI);
+            }
+        }
+
+        if (pressure.memory_events && 0 == cgroup->ReadMemoryEvents(lastMemoryEvents)) {
+            // memory.events is a kernfs file, which reports a change with EPOLLPRI until it's read again
+            memoryEventsFd = cgroup->StatFd(Cgroup::kMemoryEvents);
+            epoll_ctl_add(epfd, memoryEventsFd, EPOLLPRI);
+        }
+    }
+
+    void PublishPressure(Cgroup::Pressure resource)
+    {
+        if (reader) {
+            reader->write(PressureMessage(resource, cgroup->ReadPressure(resource)).dump());
+        }
+    }
+
+    void PublishMemoryEvents()
+    {
+        CgroupMemoryEvents events;
+        if (0 != cgroup->ReadMemoryEvents(events)) {
+            return;
+        }
+
+        auto message = MemoryEventsMessage(events, lastMemoryEvents);
+        if (!message.is_null() && reader) {
+            reader->write(message.dump());
+        }
+        lastMemoryEvents = events;
+    }
+
+    void StartFreezer()
+    {
+        if (appCgroup && reader) {
+            appEventsFd = appCgroup->StatFd(Cgroup::kEvents);
+            if (appEventsFd >= 0) {
+                epoll_ctl_add(epfd, appEventsFd, EPOLLPRI);
+            }
+        }
+    }
+
+    // {"type":"freeze"} or {"type":"thaw"} from reader, {"type":"frozen","frozen":<bool>} is sent when it's done
+    void Freeze(bool frozen)
+    {
+        if (!appCgroup || appEventsFd < 0 || 0 != appCgroup->Freeze(frozen)) {
+            reader->write(nlohmann::json({{"type", "frozen"}, {"error", "cgroup freezer is not available"}}).dump());
+            return;
+        }
+        util::trace::Instant(frozen ? "freeze" : "thaw");
+        // every request is answered, one overtaken before it's done gets the state it was left in
+        if (pendingFrozen >= 0) {
+            reader->write(nlohmann::json({{"type", "frozen"}, {"frozen", appCgroup->Frozen() == 1}}).dump());
+        }
+        pendingFrozen = frozen ? 1 : 0;
+        // it may be done already, cgroup.events is reported by epoll only when it changes after the last read
+        PublishFrozen();
+    }
+
+    void PublishFrozen()
+    {
+        // always read, or epoll keeps reporting the last change
+        int frozen = appCgroup->Frozen();
+        if (pendingFrozen < 0 || frozen != pendingFrozen || !reader) {
+            return;
+        }
+        reader->write(nlohmann::json({{"type", "frozen"}, {"frozen", pendingFrozen == 1}}).dump());
+        pendingFrozen = -1;
+    }
+
+    void PublishStats()
+    {
+        uint64_t expirations;
+        if (read(statsFd, &expirations, sizeof(expirations)) != sizeof(expirations) || !reader) {
+            return;
+        }
+
+        CgroupStats stats;
+        if (0 != cgroup->ReadStats(stats)) {
+            return;
+        }
+
+        bool delta = runtime.annotations->stats->delta && statsSent;
+        auto message = StatsMessage(stats, delta ? &lastStats : nullptr);
+        if (!message.is_null()) {
+            reader->write(message.dump());
+        }
+        lastStats = stats;
+        statsSent = true;
+    }
+
+    // a control message has a type, the others are processes to run
+    void HandleMessage(const nlohmann::json &json)
+    {
+        auto type = json.is_object() ? json.value("type", "") : "";
+        if (type == "freeze" || type == "thaw") {
+            Freeze(type == "freeze");
+            return;
+        }
+        auto process = json.get<Process>();
+        forkAndExecProcess(process);
+    }
+
+    // the process of ExecInContainer is started as one from reader, in the cgroup and under the seccomp filter of init
+    void HandleExec(int conn)
+    {
+        Process process;
+        int stdio[3];
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn, nullptr);
+        execConns.erase(conn);
+        if (0 != ReadExec(conn, runtime.process, process, stdio)) {
+            close(conn);
+            return;
+        }
+
+        util::SpawnArgs spawn(process.args, process.env, process.cwd);
+        std::copy(stdio, stdio + 3, spawn.stdio);
+        auto pid = forkAndExecProcess(process, &spawn);
+        for (auto fd : stdio) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        auto it = children.find(pid);
+        if (it == children.end()) {
+            ReplyExec(conn, -1);
+            close(conn);
+            return;
+        }
+        it->second.execConn = conn;
+    }
+
     void waitChildAndExec()
     {
         sigset_t mask;
@@ -358,57 +758,62 @@ public:
         if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
             logWan() << "sigprocmask block";
 
-        int sfd = signalfd(-1, &mask, 0);
+        // SIGCHLD is kept only to reap untracked children, exits of processes we started come from their pidfd
+        int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
         if (sfd == -1)
             logWan() << "signalfd";
 
-        auto epfd = epoll_create(1);
+        epfd = epoll_create1(EPOLL_CLOEXEC);
         epoll_ctl_add(epfd, sfd);
         if (reader.get() != nullptr)
             epoll_ctl_add(epfd, reader->fd);
+        if (execFd >= 0)
+            epoll_ctl_add(epfd, execFd);
+        for (auto &it : children) {
+            WatchChild(it.second);
+        }
+        StartStats();
+        StartPressure();
+        StartFreezer();
+        // a child may have exited before SIGCHLD was blocked
+        ReapUntracked();
+
+        // data of signalfd and reader is their fd, data of a pidfd is its ChildProcess, which never equals a small fd
+        const auto isFd = [](const epoll_event &event, int fd) {
+            return fd >= 0 && event.data.u64 == static_cast<uint64_t>(fd);
+        };
 
         for (;;) {
-            struct epoll_event events[10];
-            int event_cnt = epoll_wait(epfd, events, 5, -1);
+            // a deferred container waits for its first process
+            bool waitProcess = option.deferProcess && !processStarted && reader.get() != nullptr;
+            if (children.empty() && !waitProcess && NoChild()) {
+                logDbg() << "no child to wait";
+                return;
+            }
+
+            struct epoll_event events[kMaxEpollEvents];
+            util::Logger::Flush();
+            int event_cnt = epoll_wait(epfd, events, kMaxEpollEvents, -1);
+            if (event_cnt < 0 && errno != EINTR) {
+                logErr() << "epoll_wait failed" << util::errnoString();
+                return;
+            }
+
+            bool sigchld = false;
             for (int i = 0; i < event_cnt; i++) {
                 const auto &event = events[i];
-                if (event.data.fd == sfd) {
+                auto pressure = std::find_if(std::begin(pressureFds), std::end(pressureFds),
+                                             [&](int fd) { return isFd(event, fd); })
+                    - std::begin(pressureFds);
+                if (isFd(event, sfd)) {
                     struct signalfd_siginfo fdsi;
                     ssize_t s = read(sfd, &fdsi, sizeof(fdsi));
                     if (s != sizeof(fdsi)) {
                         logWan() << "error read from signal fd";
                     }
                     if (fdsi.ssi_signo == SIGCHLD) {
-                        logWan() << "recive SIGCHLD";
-
-                        int wstatus;
-                        while (int child = waitpid(-1, &wstatus, WNOHANG)) {
-                            if (child > 0) {
-                                std::string info;
-                                auto normal = parse_wstatus(wstatus, info);
-                                info = util::format("child [%d] [%s].", child, info.c_str());
-                                if (normal) {
-                                    logDbg() << info;
-                                } else {
-                                    logWan() << info;
-                                }
-                                auto it = pidMap.find(child);
-                                if (it != pidMap.end()) {
-                                    if (reader.get() != nullptr)
-                                        reader->writeChildExit(child, it->second, wstatus, info);
-                                    pidMap.erase(it);
-                                }
-                            } else if (child < 0) {
-                                if (errno == ECHILD) {
-                                    logDbg() << util::format("no child to wait");
-                                    return;
-                                } else {
-                                    auto str = util::errnoString();
-                                    logErr() << util::format("waitpid failed, %s", str.c_str());
-                                    return;
-                                }
-                            }
-                        }
+                        // handled after pidfds of this round, so that most exited children are already reaped
+                        sigchld = true;
                     } else if (fdsi.ssi_signo == SIGTERM) {
                         // FIXME: box should exit with failed return code.
                         logWan() << util::format("Terminated\n");
@@ -416,73 +821,128 @@ public:
                     } else {
                         logWan() << util::format("Read unexpected signal [%d]\n", fdsi.ssi_signo);
                     }
-                } else if (reader.get() != nullptr && event.data.fd == reader->fd) {
-                    auto json = reader->read();
-                    if (json.empty()) {
+                } else if (reader.get() != nullptr && isFd(event, reader->fd)) {
+                    // one read may bring several messages, those buffered behind the first are not reported again
+                    do {
+                        auto json = reader->read();
+                        if (json.empty()) {
+                            // peer closed, stop watching it or epoll will keep reporting EOF
+                            epoll_ctl(epfd, EPOLL_CTL_DEL, reader->fd, nullptr);
+                            reader.reset();
+                            break;
+                        }
+                        HandleMessage(json);
+                    } while (reader->pending());
+
+                    if (!reader) {
+                        if (option.deferProcess && !processStarted) {
+                            // a warm container which never got a process
+                            logInf() << "reader closed before any process started";
+                            return;
+                        }
                         break;
                     }
-                    auto process = json.get<Process>();
-                    forkAndExecProcess(process, true);
+                } else if (isFd(event, execFd)) {
+                    int conn = AcceptExec(execFd);
+                    if (conn >= 0) {
+                        execConns.insert(conn);
+                        epoll_ctl_add(epfd, conn);
+                    }
+                } else if (event.data.u64 < INT32_MAX && execConns.count(static_cast<int>(event.data.u64))) {
+                    HandleExec(static_cast<int>(event.data.u64));
+                } else if (isFd(event, statsFd)) {
+                    PublishStats();
+                } else if (isFd(event, memoryEventsFd)) {
+                    PublishMemoryEvents();
+                } else if (isFd(event, appEventsFd)) {
+                    PublishFrozen();
+                } else if (pressure < Cgroup::kPressureCount) {
+                    PublishPressure(static_cast<Cgroup::Pressure>(pressure));
+                } else if (event.data.ptr != nullptr) {
+                    ReapChild(*static_cast<ChildProcess *>(event.data.ptr));
                 } else {
                     logWan() << "Unknown fd";
                 }
             }
+
+            if (sigchld) {
+                ReapUntracked();
+            }
         }
-        return;
     }
 
-    bool forkAndExecProcess(const Process process, bool unblock = false)
+    // spawn is built from process if it's nullptr. Return the pid, or -1 if clone failed.
+    pid_t forkAndExecProcess(const Process process, const util::SpawnArgs *prepared = nullptr)
     {
         // FIXME: parent may dead before this return.
         prctl(PR_SET_PDEATHSIG, SIGKILL);
 
-        int pid = fork();
+        logDbg() << "process.args:" << process.args;
+        std::unique_ptr<util::SpawnArgs> built;
+        if (!prepared) {
+            built.reset(new util::SpawnArgs(process.args, process.env, process.cwd));
+            prepared = built.get();
+        }
+        auto const &spawn = *prepared;
+
+        // the child of Spawn can't log nor trace, it shares our memory until exec
+        util::trace::Instant("exec", process.args[0]);
+        int pidfd = -1;
+        int execErrno = 0;
+        int pid = util::Spawn(spawn, appCgroup ? appCgroup->Fd() : -1, &pidfd, &execErrno);
         if (pid < 0) {
-            logErr() << "fork failed" << util::RetErrString(pid);
-            return false;
+            logErr() << "spawn failed" << util::errnoString();
+            util::metrics::Fail(util::metrics::kExec);
+            return -1;
+        }
+        util::trace::Record(util::trace::kExec, static_cast<uint64_t>(pid), static_cast<uint64_t>(execErrno));
+        LL_PROBE3(exec, pid, process.args[0].c_str(), execErrno);
+        if (execErrno) {
+            // the child has exited with 127, it's reaped as others
+            logErr() << "exec" << process.args[0] << "failed" << strerror(execErrno);
+            util::metrics::Fail(util::metrics::kExec);
+        } else if (!processStarted) {
+            util::metrics::Observe(util::metrics::kTimeToExec, util::metrics::Elapsed());
         }
+        util::metrics::Add(util::metrics::kChildren);
 
-        if (0 == pid) {
-            if (unblock) {
-                // FIXME: As we use signalfd, we have to block signal, but child created by fork
-                // will inherit blocked signal set, so we have to unblock it. This is just a
-                // workround.
-                sigset_t mask;
-                sigfillset(&mask);
-                if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-                    logWan() << "sigprocmask unblock";
+        if (pidfd < 0) {
+            pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+            if (pidfd < 0) {
+                logDbg() << "pidfd_open failed" << util::errnoString();
             }
-            logDbg() << "process.args:" << process.args;
+        }
+        auto &child = children[pid];
+        child = {pid, pidfd, process.args[0], -1};
+        processStarted = true;
+        WatchChild(child);
 
-            int ret;
-            ret = chdir(process.cwd.c_str());
-            if (ret) {
-                logErr() << "failed to chdir to" << process.cwd.c_str();
-            }
+        return pid;
+    }
 
-            // for PATH
-            for (const auto &env : process.env) {
-                auto kv = util::str_spilt(env, "=");
-                if (kv.size() == 2)
-                    setenv(kv.at(0).c_str(), kv.at(1).c_str(), 1);
-                else if (kv.size() == 1) {
-                    setenv(kv.at(0).c_str(), "", 1);
-                } else {
-                    logWan() << "Unknown env:" << env;
-                }
-            }
+    // create the cgroup as the user, so that it can only be placed where the user is delegated
+    void ConfigCgroup()
+    {
+        auto euid = geteuid();
+        if (euid != getuid()) {
+            seteuid(getuid());
+        }
 
-            logInf() << "start exec process";
-            ret = util::Exec(process.args, process.env);
-            if (0 != ret) {
-                logErr() << "exec failed" << util::RetErrString(ret);
+        cgroup.reset(new Cgroup);
+        if (0 == cgroup->Open(runtime.linux.cgroupsPath)) {
+            cgroup->Apply(runtime.linux.resources);
+            appCgroup.reset(new Cgroup);
+            if (0 != cgroup->CreateChild("app", *appCgroup)) {
+                appCgroup.reset();
             }
-            exit(ret);
         } else {
-            pidMap.insert(make_pair(pid, process.args[0]));
+            logWan() << "run without cgroup" << runtime.linux.cgroupsPath;
+            cgroup.reset();
         }
 
-        return true;
+        if (euid != geteuid()) {
+            seteuid(euid);
+        }
     }
 
     int PivotRoot() const
@@ -539,6 +999,8 @@ public:
 
     int PrepareRootfs()
     {
+        TRACE_SPAN("PrepareRootfs");
+
         auto PrepareOverlayfsRootfs = [&](const AnnotationsOverlayfs &overlayfs) -> int {
             nativeMounter->Setup(new NativeFilesystemDriver(overlayfs.lower_parent));
 
@@ -578,9 +1040,8 @@ public:
         auto PrepareNativeRootfs = [&](const AnnotationsNativeRootfs &native) -> int {
             nativeMounter->Setup(new NativeFilesystemDriver(runtime.root.path));
 
-            for (const auto &mount : native.mounts) {
-                nativeMounter->MountNode(mount);
-            }
+            // planned together with runtime.mounts in PlanContainerPath
+            rootfsMounts = native.mounts;
 
             containerMounter = nativeMounter.get();
             return -1;
@@ -601,16 +1062,112 @@ public:
         return -1;
     }
 
-    int MountContainerPath()
+    MountPlan PlanContainerPath() const
     {
+        TRACE_SPAN("PlanContainerPath");
+
+        auto mounts = rootfsMounts;
         if (runtime.mounts.has_value()) {
-            for (auto const &mount : runtime.mounts.value()) {
-                containerMounter->MountNode(mount);
+            mounts.insert(mounts.end(), runtime.mounts->begin(), runtime.mounts->end());
+        }
+
+        auto plan = containerMounter->Plan(mounts);
+        if (option.linkLfs) {
+            for (auto const &dir : {"bin", "lib", "lib32", "lib64", "libx32"}) {
+                plan.Link(util::format("/usr/%s", dir), util::format("/%s", dir));
             }
-        };
+        }
+        logDbg() << "mount plan:" << plan.Steps().size() << "steps of" << mounts.size() << "mounts,"
+                 << plan.SyscallCount() << "syscalls";
+        util::trace::Record(util::trace::kMountPlan, plan.Steps().size(), static_cast<uint64_t>(plan.SyscallCount()));
+
+        if (util::fs::exists("/tmp/ll-debug")) {
+            std::ofstream dump(util::format("/tmp/ll-debug/%s-mount-plan.txt", util::GetPidnsPid().c_str()));
+            plan.Dump(dump);
+        }
+        return plan;
+    }
+
+    // find runtime.process.args[0] in the files the plan will mount. The file found is read ahead and kept as an O_PATH
+    // fd for execveat, unless it's a script or on a mount with noexec or nosuid, which the fd opened on host would
+    // bypass. A file the plan can't tell about is left to exec. Return -1 if the plan has none of the candidates, so
+    // the launch fails before mounting anything.
+    int ResolveProcess(const MountPlan &plan)
+    {
+        TRACE_SPAN("ResolveProcess");
+
+        // overlayfs and fuse-proxy mount a tree built later
+        if (option.deferProcess || containerMounter != nativeMounter.get() || runtime.process.args.empty()) {
+            return 0;
+        }
+
+        auto const &process = runtime.process;
+        processSpawn.reset(new util::SpawnArgs(process.args, process.env, process.cwd));
+
+        bool missing = true;
+        for (auto const &path : processSpawn->paths) {
+            auto containerPath = path[0] == '/' ? path : process.cwd + "/" + path;
+            std::string hostPath;
+            const MountStep *step = nullptr;
+            int ret = plan.Resolve(containerPath, hostPath, &step);
+            if (ret < 0) {
+                // leave it to exec
+                logDbg() << "can't resolve" << containerPath;
+                return 0;
+            }
+            if (ret == 0) {
+                continue;
+            }
+            missing = false;
+
+            int fd = open(hostPath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                logDbg() << "open" << hostPath << "failed" << util::errnoString();
+                return 0;
+            }
+            struct stat st {
+            };
+            char magic[2] = {};
+            bool isFile = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+            bool script = pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && magic[0] == '#' && magic[1] == '!';
+            if (isFile) {
+                readahead(fd, 0, static_cast<size_t>(st.st_size));
+            }
+            close(fd);
+            if (!isFile) {
+                // execvpe goes on too
+                continue;
+            }
+
+            logDbg() << "resolved" << containerPath << "to" << hostPath;
+            if (!script && !(step->mount.flags & (MS_NOEXEC | MS_NOSUID))) {
+                processSpawn->fd = open(hostPath.c_str(), O_PATH | O_CLOEXEC);
+            }
+            return 0;
+        }
 
+        if (missing) {
+            logErr() << "exec" << process.args[0] << "failed" << strerror(ENOENT);
+            util::metrics::Fail(util::metrics::kExec);
+            return -1;
+        }
+        logDbg() << process.args[0] << "is not a regular file in the plan, leave it to exec";
         return 0;
     }
+
+    int MountContainerPath(const MountPlan &plan)
+    {
+        TRACE_SPAN("MountContainerPath");
+        auto begin = util::metrics::Elapsed();
+        int ret = containerMounter->Execute(plan);
+        util::trace::Record(util::trace::kMountDone, ret != 0);
+        util::metrics::Observe(util::metrics::kMountTime, util::metrics::Elapsed() - begin);
+        if (ret != 0) {
+            util::metrics::Fail(util::metrics::kMount);
+        }
+        LL_PROBE1(entry__mounted, ret);
+        return ret;
+    }
 };
 
 int HookExec(const Hook &hook)
@@ -638,8 +1195,11 @@ int HookExec(const Hook &hook)
 int NonePrivilegeProc(void *arg)
 {
     auto &containerPrivate = *reinterpret_cast<ContainerPrivate *>(arg);
+    util::trace::ThreadName("init");
+    LL_PROBE(init__start);
 
     if (containerPrivate.option.rootless) {
+        TRACE_SPAN("ConfigUserNamespace");
         // TODO(iceyer): use option
 
         Linux linux;
@@ -666,19 +1226,42 @@ int NonePrivilegeProc(void *arg)
 
     if (containerPrivate.runtime.hooks.has_value() && containerPrivate.runtime.hooks->prestart.has_value()) {
         for (auto const &preStart : *containerPrivate.runtime.hooks->prestart) {
+            TRACE_SPAN("HookExec", preStart.path);
             HookExec(preStart);
         }
     }
 
+    // before the seccomp filter, which may not allow a socket
+    containerPrivate.execFd = ListenExec();
+
     if (!containerPrivate.option.rootless) {
         seteuid(0);
         // todo: check return value
-        ConfigSeccomp(containerPrivate.runtime.linux.seccomp);
+        {
+            TRACE_SPAN("ConfigSeccomp");
+            LL_PROBE1(seccomp__start, containerPrivate.seccompPrepared);
+            if (containerPrivate.seccompPrepared) {
+                ret = LoadSeccompProgram(containerPrivate.seccompProgram);
+            } else {
+                ret = ConfigSeccomp(containerPrivate.runtime.linux.seccomp);
+            }
+            LL_PROBE1(seccomp__done, ret);
+            if (ret != 0) {
+                util::metrics::Fail(util::metrics::kSeccomp);
+            }
+        }
         ContainerPrivate::DropPermissions();
     }
 
-    containerPrivate.forkAndExecProcess(containerPrivate.runtime.process);
+    if (!containerPrivate.option.deferProcess) {
+        TRACE_SPAN("forkAndExecProcess");
+        containerPrivate.forkAndExecProcess(containerPrivate.runtime.process, containerPrivate.processSpawn.get());
+    }
+
+    // the fd pins the old root
+    containerPrivate.processSpawn.reset();
 
+    LL_PROBE(init__ready);
     containerPrivate.waitChildAndExec();
     return 0;
 }
@@ -691,8 +1274,11 @@ void sigtermHandler(int)
 int EntryProc(void *arg)
 {
     auto &containerPrivate = *reinterpret_cast<ContainerPrivate *>(arg);
+    util::trace::ThreadName("entry");
+    LL_PROBE(entry__start);
 
     if (containerPrivate.option.rootless) {
+        TRACE_SPAN("ConfigUserNamespace");
         ConfigUserNamespace(containerPrivate.runtime.linux, 0);
     }
 
@@ -722,44 +1308,61 @@ int EntryProc(void *arg)
     // NOTE(iceyer): it's not standard oci action
     containerPrivate.PrepareRootfs();
 
-    containerPrivate.MountContainerPath();
-
-    if (containerPrivate.useNewCgroupNs) {
-        ConfigCgroupV2(containerPrivate.runtime.linux.cgroupsPath, containerPrivate.runtime.linux.resources, getpid());
+    if (containerPrivate.dbusProxyReadyFd >= 0) {
+        TRACE_SPAN("WaitDbusProxy");
+        WaitDbusProxy(containerPrivate.runtime.annotations->dbus_proxy_info->proxy_path,
+                      containerPrivate.dbusProxyReadyFd);
+        containerPrivate.dbusProxyReadyFd = -1;
     }
 
-    containerPrivate.PrepareDefaultDevices();
-
-    containerPrivate.PivotRoot();
+    {
+        auto plan = containerPrivate.PlanContainerPath();
+        if (0 != containerPrivate.ResolveProcess(plan)) {
+            return -1;
+        }
+        // nothing to build the container on if the fuse helper did not mount
+        if (0 != containerPrivate.containerMounter->Wait()) {
+            util::metrics::Fail(util::metrics::kMount);
+            return -1;
+        }
+        containerPrivate.MountContainerPath(plan);
+    }
 
-    containerPrivate.PrepareLinks();
+    {
+        TRACE_SPAN("PrepareDefaultDevices");
+        containerPrivate.PrepareDefaultDevices();
+    }
 
-    if (!containerPrivate.option.rootless) {
-        auto unshareFlags = 0;
-        // TODO(iceyer): no need user namespace in setuid
-        //        if (c.use_delay_new_user_ns) {
-        //            unshare_flags |= CLONE_NEWUSER;
-        //        }
-        if (containerPrivate.useNewCgroupNs) {
-            unshareFlags |= CLONE_NEWCGROUP;
-        }
-        if (unshareFlags) {
-            ret = unshare(unshareFlags);
-            if (0 != ret) {
-                logErr() << "unshare failed" << unshareFlags << util::RetErrString(ret);
-            }
+    {
+        TRACE_SPAN("PivotRoot");
+        ret = containerPrivate.PivotRoot();
+        util::trace::Record(util::trace::kPivotRoot, ret != 0);
+        LL_PROBE1(entry__pivoted, ret);
+        if (ret != 0) {
+            util::metrics::Fail(util::metrics::kPivotRoot);
         }
-        //        if (c.use_delay_new_user_ns) {
-        //            s.vrijgeven();
-        //            s.passeren();
-        //        }
+    }
+
+    {
+        TRACE_SPAN("PrepareLinks");
+        containerPrivate.PrepareLinks();
     }
 
     int nonePrivilegeProcFlag = SIGCHLD | CLONE_NEWUSER | CLONE_NEWPID | CLONE_NEWNS;
+    // TODO(iceyer): no need user namespace in setuid
+    // the cgroup namespace is created with init, so that its root is the cgroup init is born in
+    if (!containerPrivate.option.rootless && containerPrivate.useNewCgroupNs) {
+        nonePrivilegeProcFlag |= CLONE_NEWCGROUP;
+    }
 
-    int noPrivilegePid = util::PlatformClone(NonePrivilegeProc, nonePrivilegeProcFlag, arg);
+    auto cloneBegin = util::trace::Now();
+    int noPrivilegePid = CloneInit(NonePrivilegeProc, nonePrivilegeProcFlag, arg, containerPrivate.cgroup.get());
+    util::trace::Complete("PlatformClone", cloneBegin, util::trace::Now(), "init");
+    util::trace::Record(util::trace::kCloneInit, static_cast<uint64_t>(noPrivilegePid), noPrivilegePid < 0 ? errno : 0);
+    LL_PROBE1(init__cloned, noPrivilegePid);
     if (noPrivilegePid < 0) {
         logErr() << "clone failed" << util::RetErrString(noPrivilegePid);
+        util::metrics::Fail(util::metrics::kCloneInit);
         return -1;
     }
 
@@ -786,6 +1389,14 @@ int Container::Start(const Option &option)
     auto &contanerPrivate = *reinterpret_cast<ContainerPrivate *>(dd_ptr.get());
     contanerPrivate.option = option;
 
+    if (contanerPrivate.runtime.annotations.has_value() && contanerPrivate.runtime.annotations->trace_dir.has_value()) {
+        util::trace::Open(*contanerPrivate.runtime.annotations->trace_dir);
+    }
+    util::trace::ThreadName("ll-box");
+    // mapped before entry is cloned, so that every process of the box writes to it
+    util::trace::OpenRing();
+    LL_PROBE(start__start);
+
     if (option.rootless) {
         contanerPrivate.hostUid = geteuid();
         contanerPrivate.hostGid = getegid();
@@ -817,13 +1428,45 @@ int Container::Start(const Option &option)
         flags |= CLONE_NEWUSER;
     }
 
-    StartDbusProxy(contanerPrivate.runtime);
+    // shared with entry and init like the ring, a config rejected above is not a launch
+    util::metrics::Open();
+    util::perf::Open();
+
+    {
+        TRACE_SPAN("StartDbusProxy");
+        StartDbusProxy(contanerPrivate.runtime, contanerPrivate.dbusProxyReadyFd);
+    }
+
+    if (!option.rootless) {
+        TRACE_SPAN("PrepareSeccomp");
+        contanerPrivate.seccompPrepared =
+            0 == PrepareSeccomp(contanerPrivate.runtime.linux.seccomp, util::RuntimeCache::DefaultDir(),
+                                contanerPrivate.seccompProgram);
+    }
 
+    if (!contanerPrivate.runtime.linux.cgroupsPath.empty()) {
+        TRACE_SPAN("ConfigCgroup");
+        contanerPrivate.ConfigCgroup();
+    }
+
+    auto cloneBegin = util::trace::Now();
     int entryPid = util::PlatformClone(EntryProc, flags, (void *)dd_ptr.get());
+    util::trace::Complete("PlatformClone", cloneBegin, util::trace::Now(), "entry");
+    util::trace::Record(util::trace::kCloneEntry, static_cast<uint64_t>(entryPid), entryPid < 0 ? errno : 0);
+    LL_PROBE1(entry__cloned, entryPid);
+
+    // entry has its own copy
+    if (contanerPrivate.dbusProxyReadyFd >= 0) {
+        close(contanerPrivate.dbusProxyReadyFd);
+        contanerPrivate.dbusProxyReadyFd = -1;
+    }
     if (entryPid < 0) {
         logErr() << "clone failed" << util::RetErrString(entryPid);
+        util::metrics::Fail(util::metrics::kCloneEntry);
+        util::metrics::Write(true);
         return -1;
     }
+    util::metrics::Write();
 
     contanerPrivate.reader.reset();
 
@@ -834,9 +1477,23 @@ int Container::Start(const Option &option)
     // FIXME: parent may dead before this return.
     prctl(PR_SET_PDEATHSIG, SIGKILL);
 
+    // children started and reaped by init show up before the box exits
+    util::metrics::Watch();
+
     // FIXME(interactive bash): if need keep interactive shell
     util::WaitAllUntil(entryPid);
 
+    if (contanerPrivate.appCgroup) {
+        contanerPrivate.appCgroup->Remove();
+    }
+    if (contanerPrivate.cgroup) {
+        contanerPrivate.cgroup->Remove();
+    }
+
+    util::trace::Record(util::trace::kExit);
+    util::metrics::Write(true);
+    util::perf::Report(std::cerr);
+    LL_PROBE(start__done);
     return 0;
 }
 
@@ -20,6 +20,9 @@ namespace linglong {
 struct Option {
     bool rootless = false;
     bool linkLfs = true;
+    // do not start runtime.process, the init waits for a Process sent over the reader instead.
+    // used by the zygote server to keep containers warm.
+    bool deferProcess = false;
 };
 
 } // namespace linglong
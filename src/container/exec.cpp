@@ -0,0 +1,341 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "exec.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <csignal>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#include "util/logger.h"
+#include "util/platform.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+namespace linglong {
+
+struct NamespaceFile {
+    const char *name;
+    int type;
+};
+
+// user first, joining it gives the capabilities needed to join the others
+static const NamespaceFile kNamespaces[] = {
+    {"user", CLONE_NEWUSER}, {"mnt", CLONE_NEWNS},  {"pid", CLONE_NEWPID},       {"uts", CLONE_NEWUTS},
+    {"ipc", CLONE_NEWIPC},   {"net", CLONE_NEWNET}, {"cgroup", CLONE_NEWCGROUP},
+};
+
+// namespaces of pid which differ from ours, joining our own user namespace is refused by kernel
+static int DifferentNamespaces(pid_t pid)
+{
+    int flags = 0;
+    for (auto const &ns : kNamespaces) {
+        struct stat self {
+        }, target {
+        };
+        if (0 != stat(util::format("/proc/self/ns/%s", ns.name).c_str(), &self)
+            || 0 != stat(util::format("/proc/%d/ns/%s", pid, ns.name).c_str(), &target)) {
+            continue;
+        }
+        if (self.st_ino != target.st_ino || self.st_dev != target.st_dev) {
+            flags |= ns.type;
+        }
+    }
+    return flags;
+}
+
+static int JoinNamespaces(pid_t pid, int pidfd, int flags)
+{
+    if (0 == setns(pidfd, flags)) {
+        return 0;
+    }
+    if (errno != EINVAL) {
+        logErr() << "setns pidfd failed" << util::errnoString();
+        return -1;
+    }
+
+    // kernel before 5.8 only accepts a namespace fd, open all of them before /proc changes with mnt
+    logDbg() << "setns with pidfd is not supported, join namespaces one by one";
+    std::map<int, int> fds;
+    for (auto const &ns : kNamespaces) {
+        if (flags & ns.type) {
+            auto fd = open(util::format("/proc/%d/ns/%s", pid, ns.name).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                logErr() << "open namespace" << ns.name << "failed" << util::errnoString();
+                break;
+            }
+            fds[ns.type] = fd;
+        }
+    }
+
+    int ret = 0;
+    for (auto const &ns : kNamespaces) {
+        auto it = fds.find(ns.type);
+        if (it == fds.end()) {
+            ret = (flags & ns.type) ? -1 : ret;
+            continue;
+        }
+        if (0 == ret && 0 != setns(it->second, ns.type)) {
+            logErr() << "setns" << ns.name << "failed" << util::errnoString();
+            ret = -1;
+        }
+        close(it->second);
+    }
+    return ret;
+}
+
+static util::str_vec MergeEnv(util::str_vec env, const util::str_vec &overrides)
+{
+    for (auto const &kv : overrides) {
+        auto key = kv.substr(0, kv.find('=') + 1);
+        auto it = std::find_if(env.begin(), env.end(),
+                               [&](const std::string &e) { return e.compare(0, key.size(), key) == 0; });
+        if (it != env.end()) {
+            *it = kv;
+        } else {
+            env.push_back(kv);
+        }
+    }
+    return env;
+}
+
+// a request is one message, the json of Process
+static const size_t kMaxRequestSize = 64 * 1024;
+
+// the abstract address of init of the container in mount namespace mntns
+static socklen_t ExecAddress(ino_t mntns, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    auto name = util::format("linglong/box/exec/%llu", static_cast<unsigned long long>(mntns));
+    // sun_path[0] is '\0'
+    strncpy(addr.sun_path + 1, name.c_str(), sizeof(addr.sun_path) - 2);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + name.size());
+}
+
+int ListenExec()
+{
+    struct stat st {
+    };
+    if (0 != stat("/proc/self/ns/mnt", &st)) {
+        logWan() << "stat mount namespace failed" << util::errnoString();
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        logWan() << "socket failed" << util::errnoString();
+        return -1;
+    }
+    struct sockaddr_un addr;
+    auto len = ExecAddress(st.st_ino, addr);
+    if (0 != bind(fd, reinterpret_cast<struct sockaddr *>(&addr), len) || 0 != listen(fd, 16)) {
+        logWan() << "listen for exec failed" << util::errnoString();
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int AcceptExec(int listenFd)
+{
+    int conn = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (conn < 0) {
+        return -1;
+    }
+
+    // the socket is reachable from the whole network namespace, which may be the one of the host
+    struct ucred cred = {};
+    socklen_t len = sizeof(cred);
+    if (0 != getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) || (cred.uid != getuid() && cred.uid != 0)) {
+        logWan() << "reject exec of uid" << cred.uid << "pid" << cred.pid;
+        close(conn);
+        return -1;
+    }
+    return conn;
+}
+
+int ReadExec(int conn, const Process &container, Process &process, int stdio[3])
+{
+    std::string buf(kMaxRequestSize, '\0');
+    struct iovec iov = {&buf[0], buf.size()};
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    auto n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        return -1;
+    }
+
+    stdio[0] = stdio[1] = stdio[2] = -1;
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            auto count = std::min<size_t>((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int), 3);
+            memcpy(stdio, CMSG_DATA(cmsg), count * sizeof(int));
+        }
+    }
+
+    try {
+        auto request = nlohmann::json::parse(buf.substr(0, static_cast<size_t>(n))).get<Process>();
+        if ((msg.msg_flags & MSG_TRUNC) || request.args.empty()) {
+            throw std::runtime_error("no args or truncated");
+        }
+        process.args = request.args;
+        process.env = MergeEnv(container.env, request.env);
+        process.cwd = request.cwd.empty() ? container.cwd : request.cwd;
+    } catch (const std::exception &e) {
+        logWan() << "invalid exec request:" << e.what();
+        return -1;
+    }
+    return 0;
+}
+
+void ReplyExec(int conn, int wstatus)
+{
+    auto reply = nlohmann::json({{"wstatus", wstatus}}).dump();
+    if (send(conn, reply.c_str(), reply.size(), MSG_NOSIGNAL) < 0) {
+        logDbg() << "reply exec failed" << util::errnoString();
+    }
+}
+
+static int SendRequest(int fd, const Process &process)
+{
+    auto request = nlohmann::json(process).dump();
+    struct iovec iov = {&request[0], request.size()};
+    int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    union {
+        char buf[CMSG_SPACE(sizeof(stdio))];
+        struct cmsghdr align;
+    } control = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(stdio));
+    memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(request.size()) ? 0 : -1;
+}
+
+int ExecInContainer(pid_t pid, const Process &process)
+{
+    if (process.args.empty()) {
+        logErr() << "nothing to exec";
+        return -1;
+    }
+
+    // never carry a setuid privilege into a container
+    if (0 != setgid(getgid()) || 0 != setuid(getuid())) {
+        logErr() << "drop privilege failed" << util::errnoString();
+        return -1;
+    }
+
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd < 0) {
+        logErr() << "pidfd_open" << pid << "failed" << util::errnoString();
+        return -1;
+    }
+
+    // the paths below belong to pid only after the pidfd is open and pid is still alive
+    struct stat st {
+    }, mntns {
+    };
+    auto procDir = util::format("/proc/%d", pid);
+    if (0 != stat(procDir.c_str(), &st) || (getuid() != 0 && st.st_uid != getuid())) {
+        logErr() << "container" << pid << "is not owned by" << getuid();
+        close(pidfd);
+        return -1;
+    }
+
+    // the network namespace holds the socket, the user namespace gives the capability to join it
+    auto flags = DifferentNamespaces(pid) & (CLONE_NEWUSER | CLONE_NEWNET);
+    if (0 != stat((procDir + "/ns/mnt").c_str(), &mntns) || 0 != syscall(SYS_pidfd_send_signal, pidfd, 0, nullptr, 0)) {
+        logErr() << "container" << pid << "is gone" << util::errnoString();
+        close(pidfd);
+        return -1;
+    }
+
+    int ret = flags ? JoinNamespaces(pid, pidfd, flags) : 0;
+    close(pidfd);
+    if (0 != ret) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    auto len = ExecAddress(mntns.st_ino, addr);
+    if (fd < 0 || 0 != connect(fd, reinterpret_cast<struct sockaddr *>(&addr), len)) {
+        logErr() << "connect to init of container" << pid << "failed" << util::errnoString();
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if (0 != SendRequest(fd, process)) {
+        logErr() << "send exec request failed" << util::errnoString();
+        close(fd);
+        return -1;
+    }
+
+    // init answers when the process exits, or closes the connection if it could not be started
+    char reply[256];
+    ssize_t n;
+    while ((n = recv(fd, reply, sizeof(reply) - 1, 0)) < 0 && errno == EINTR) {
+    }
+    close(fd);
+    if (n <= 0) {
+        logErr() << "init of container" << pid << "did not start" << process.args[0];
+        return -1;
+    }
+
+    int wstatus = 0;
+    try {
+        wstatus = nlohmann::json::parse(std::string(reply, static_cast<size_t>(n))).at("wstatus").get<int>();
+    } catch (const std::exception &e) {
+        logErr() << "invalid exec reply:" << e.what();
+        return -1;
+    }
+    if (wstatus < 0) {
+        logErr() << "start" << process.args[0] << "failed";
+        return -1;
+    }
+    if (WIFSIGNALED(wstatus)) {
+        return 128 + WTERMSIG(wstatus);
+    }
+    return WEXITSTATUS(wstatus);
+}
+
+} // namespace linglong
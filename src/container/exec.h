@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_CONTAINER_EXEC_H_
+#define LINGLONG_BOX_SRC_CONTAINER_EXEC_H_
+
+#include <sys/types.h>
+
+#include "util/oci_runtime.h"
+
+namespace linglong {
+
+/*!
+ * Run process in a running container, pid is any process of the container, usually its init.
+ *
+ * The process is started by init of the container the same way as the processes it gets over its reader, so it's
+ * born in the app cgroup, inherits the seccomp filter of init and gets the environment of the container: process.env
+ * is applied over runtime.process.env, empty process.cwd means runtime.process.cwd. stdin, stdout and stderr of the
+ * caller are passed to it.
+ *
+ * init listens on an abstract seqpacket socket named after its mount namespace. The caller joins the user and network
+ * namespaces of pid which differ from ours, sends process with its stdio by SCM_RIGHTS and waits for the wait status,
+ * which init sends when the process exits. init accepts its own uid and root only.
+ *
+ * Return the exit code of process, or -1 if it could not be started.
+ */
+int ExecInContainer(pid_t pid, const Process &process);
+
+// the side of init, listen for ExecInContainer. Return the socket, or -1 if it failed.
+int ListenExec();
+
+// accept a connection on the socket of ListenExec, return it or -1 if the peer is not allowed
+int AcceptExec(int listenFd);
+
+// read a request of ExecInContainer from conn, env and cwd are completed from container, the process of the runtime.
+// stdio are the fds received, owned by the caller. Return -1 if conn is closed or the request is invalid.
+int ReadExec(int conn, const Process &container, Process &process, int stdio[3]);
+
+// send the wait status of the process to conn, -1 if it could not be started
+void ReplyExec(int conn, int wstatus);
+
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_CONTAINER_EXEC_H_ */
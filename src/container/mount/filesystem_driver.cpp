@@ -4,15 +4,33 @@
  * SPDX-License-Identifier: LGPL-3.0-or-later
  */
 
+#include <sys/vfs.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
 
+#include <cstdlib>
 #include <utility>
 
 #include "filesystem_driver.h"
 #include "util/platform.h"
+#include "util/trace.h"
 
 namespace linglong {
 
+// from linux/magic.h
+static const long kFuseSuperMagic = 0x65735546;
+// milliseconds the fuse daemon is given to mount, the launch fails after it
+static const int kDefaultFuseMountTimeout = 3000;
+
+// LL_BOX_FUSE_TIMEOUT in milliseconds
+static int FuseMountTimeout()
+{
+    auto env = getenv("LL_BOX_FUSE_TIMEOUT");
+    int timeout = env ? atoi(env) : 0;
+    return timeout > 0 ? timeout : kDefaultFuseMountTimeout;
+}
+
 FilesystemDriver::~FilesystemDriver() = default;
 
 OverlayfsFuseFilesystemDriver::OverlayfsFuseFilesystemDriver(util::str_vec lower_dirs, std::string upper_dir,
@@ -66,7 +84,20 @@ int OverlayfsFuseFilesystemDriver::Setup()
 
         exit(0);
     }
-    util::Wait(pid);
+    if (pid < 0) {
+        logErr() << "fork failed:" << util::errnoString();
+        return -1;
+    }
+    pid_ = pid;
+    return 0;
+}
+
+int OverlayfsFuseFilesystemDriver::Wait()
+{
+    if (pid_ > 0) {
+        util::Wait(pid_);
+        pid_ = -1;
+    }
     return 0;
 }
 
@@ -179,4 +210,41 @@ int FuseProxyFilesystemDriver::Setup()
     }
 }
 
+// ll-fuse-proxy stays in foreground, wait for the fuse mount to appear on mount_point_.
+int FuseProxyFilesystemDriver::Wait()
+{
+    // mountinfo reports POLLPRI on every change of the mount table, no need to poll with sleep.
+    int fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    int limit = FuseMountTimeout();
+    int waited = 0;
+    int ret = -1;
+
+    for (;;) {
+        struct statfs st {
+        };
+        if (0 == statfs(mount_point_.c_str(), &st) && st.f_type == kFuseSuperMagic) {
+            ret = 0;
+            break;
+        }
+        if (waited >= limit) {
+            logErr() << "fuse proxy is not mounted on" << mount_point_ << "in" << limit << "ms";
+            break;
+        }
+
+        struct pollfd pfd = {fd, POLLPRI, 0};
+        int timeout = fd < 0 ? 10 : limit - waited;
+        auto begin = util::trace::Now();
+        if (poll(&pfd, fd < 0 ? 0 : 1, timeout) < 0 && errno != EINTR) {
+            logErr() << "poll failed" << util::errnoString();
+            break;
+        }
+        waited += static_cast<int>((util::trace::Now() - begin) / 1000) + 1;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ret;
+}
+
 } // namespace linglong
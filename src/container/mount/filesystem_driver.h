@@ -14,7 +14,11 @@ namespace linglong {
 class FilesystemDriver
 {
 public:
+    // start the filesystem, a driver backed by a helper process may return before it is mounted
     virtual int Setup() = 0;
+    // block until the filesystem started by Setup is mounted, HostMount calls it before the first use. Return -1 if
+    // it's not mounted, the container can not be built on it.
+    virtual int Wait() { return 0; }
     virtual ~FilesystemDriver();
     virtual int CreateDestinationPath(const util::fs::path &container_destination_path) = 0;
     virtual util::fs::path HostPath(const util::fs::path &container_destination_path) const = 0;
@@ -29,6 +33,8 @@ public:
 
     int Setup() override;
 
+    int Wait() override;
+
     int CreateDestinationPath(const util::fs::path &container_destination_path) override;
 
     util::fs::path HostPath(const util::fs::path &dest_full_path) const override;
@@ -40,6 +46,8 @@ private:
     std::string upper_dir_;
     std::string work_dir_;
     std::string mount_point_;
+    // fuse-overlayfs exits after the mount is ready and the daemon is forked
+    int pid_ = -1;
 };
 
 class FuseProxyFilesystemDriver : public FilesystemDriver
@@ -49,6 +57,8 @@ public:
 
     int Setup() override;
 
+    int Wait() override;
+
     int CreateDestinationPath(const util::fs::path &container_destination_path) override;
 
     util::fs::path HostPath(const util::fs::path &dest_full_path) const override;
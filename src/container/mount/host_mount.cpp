@@ -7,52 +7,91 @@
 #include "host_mount.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <utility>
 
 #include "filesystem_driver.h"
+#include "mount_plan.h"
 #include "util/debug/debug.h"
+#include "util/metrics.h"
+#include "util/probe.h"
+#include "util/trace.h"
+#include "util/trace_ring.h"
 
 namespace linglong {
 
+// mounting is mostly waiting on locks of the kernel and the filesystems, more threads than this do not help.
+static const int kDefaultMountWorkers = 4;
+
 class HostMountPrivate
 {
 public:
     explicit HostMountPrivate() = default;
 
+    ~HostMountPrivate()
+    {
+        if (rootFd >= 0) {
+            close(rootFd);
+        }
+    }
+
     int CreateDestinationPath(const util::fs::path &container_destination_path) const
     {
+        if (0 != WaitDriver()) {
+            return -1;
+        }
         return driver_->CreateDestinationPath(container_destination_path);
     }
 
+    // the driver is started in Setup, it's awaited only here, so the helper starts while the plan is compiled.
+    int WaitDriver() const
+    {
+        if (!driverReady) {
+            TRACE_SPAN("FilesystemDriver::Wait");
+            driverStatus = driver_->Wait();
+            driverReady = true;
+        }
+        return driverStatus;
+    }
+
     int MountNode(const struct Mount &m) const
     {
+        TRACE_SPAN("MountNode", m.destination);
+        if (0 != WaitDriver()) {
+            return -1;
+        }
+
         int ret = -1;
         struct stat source_stat {
         };
-        bool is_path = false;
 
-        auto source = m.source;
+        MountStep step;
+        step.mount = m;
+        step.source = m.source;
 
         if (!m.source.empty() && m.source[0] == '/') {
-            is_path = true;
-            source = driver_->HostSource(util::fs::path(m.source)).string();
+            step.isPath = true;
+            step.source = driver_->HostSource(util::fs::path(m.source)).string();
         }
 
-        ret = lstat(source.c_str(), &source_stat);
+        ret = lstat(step.source.c_str(), &source_stat);
         if (0 == ret) {
         } else {
             // source not exist
             if (m.fsType == Mount::Bind) {
-                logErr() << "lstat" << source << "failed";
+                logErr() << "lstat" << step.source << "failed";
                 return -1;
             }
         }
+        step.sourceType = source_stat.st_mode & S_IFMT;
 
         auto dest_full_path = util::fs::path(m.destination);
         auto dest_parent_path = util::fs::path(dest_full_path).parent_path();
         auto host_dest_full_path = driver_->HostPath(dest_full_path);
-        auto root = driver_->HostPath(util::fs::path("/"));
 
         logDbg() << "host_dest_full_path" << host_dest_full_path;
 
@@ -71,7 +110,7 @@ public:
         case S_IFLNK: {
             driver_->CreateDestinationPath(dest_parent_path);
             host_dest_full_path.touch();
-            source = util::fs::read_symlink(util::fs::path(source)).string();
+            step.source = util::fs::read_symlink(util::fs::path(step.source)).string();
             break;
         }
         case S_IFREG: {
@@ -84,16 +123,152 @@ public:
             break;
         default:
             driver_->CreateDestinationPath(dest_full_path);
-            if (is_path) {
-                logWan() << "unknown file type" << (source_stat.st_mode & S_IFMT) << source;
+            if (step.isPath) {
+                logWan() << "unknown file type" << (source_stat.st_mode & S_IFMT) << step.source;
             }
             break;
         }
 
+        return DoMount(step);
+    }
+
+    // run the steps of plan, mount points are created as the plan said without checking
+    int Execute(const MountPlan &plan) const
+    {
+        if (0 != WaitDriver()) {
+            return -1;
+        }
+        driver_->CreateDestinationPath(util::fs::path("/"));
+
+        auto const &steps = plan.Steps();
+        auto groups = plan.Subtrees();
+        size_t workers = std::min(MountWorkers(), groups.size());
+
+        if (workers <= 1) {
+            int failed = 0;
+            for (size_t i = 0; i < steps.size(); ++i) {
+                int stepFailed = RunStep(steps[i], true);
+                util::trace::Record(util::trace::kMountStep, i, static_cast<uint64_t>(stepFailed));
+                failed += stepFailed;
+            }
+            return failed ? -1 : 0;
+        }
+
+        // directories of group roots are on the rootfs and may be shared by groups, create them before starting.
+        for (auto const &group : groups) {
+            CreateDirectories(steps[group.front()]);
+        }
+
+        // the worker threads must share a valid rootFd, open it here.
+        if (util::fs::new_mount_api_available()) {
+            OpenRootFd();
+        }
+
+        std::atomic<size_t> next(0);
+        std::atomic<int> failed(0);
+        auto worker = [&]() {
+            size_t index;
+            while ((index = next++) < groups.size()) {
+                auto const &group = groups[index];
+                for (size_t i = 0; i < group.size(); ++i) {
+                    int stepFailed = RunStep(steps[group[i]], i != 0);
+                    util::trace::Record(util::trace::kMountStep, group[i], static_cast<uint64_t>(stepFailed));
+                    failed += stepFailed;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < workers; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        logDbg() << "mounted" << steps.size() << "steps in" << groups.size() << "subtrees with" << workers
+                 << "workers";
+        return failed ? -1 : 0;
+    }
+
+    // LL_BOX_MOUNT_WORKERS, 1 to mount serially
+    static size_t MountWorkers()
+    {
+        static size_t workers = 0;
+        if (workers == 0) {
+            auto env = getenv("LL_BOX_MOUNT_WORKERS");
+            int n = env ? atoi(env) : 0;
+            if (n <= 0) {
+                n = std::min(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1), kDefaultMountWorkers);
+            }
+            workers = static_cast<size_t>(n);
+        }
+        return workers;
+    }
+
+    void CreateDirectories(const MountStep &step) const
+    {
+        for (auto const &dir : step.directories) {
+            auto host_dir = driver_->HostPath(util::fs::path(dir)).string();
+            if (0 != mkdir(host_dir.c_str(), 0755) && errno != EEXIST) {
+                logErr() << "mkdir" << host_dir << util::errnoString();
+            }
+        }
+    }
+
+    // return 1 if failed
+    int RunStep(const MountStep &step, bool mkdirs) const
+    {
+        TRACE_SPAN("MountNode", step.mount.destination);
+
+        if (step.sourceMissing) {
+            logErr() << "lstat" << step.source << "failed";
+            return 1;
+        }
+
+        if (mkdirs) {
+            CreateDirectories(step);
+        }
+
+        if (step.touch) {
+            auto host_file = driver_->HostPath(util::fs::path(step.mount.destination)).string();
+            int fd = open(host_file.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                logErr() << "create" << host_file << util::errnoString();
+            } else {
+                close(fd);
+            }
+        }
+
+        return 0 != DoMount(step) ? 1 : 0;
+    }
+
+    int DoMount(const MountStep &step) const
+    {
+        LL_PROBE3(mount__start, step.source.c_str(), step.mount.destination.c_str(), step.mount.type.c_str());
+        int ret = DoMountStep(step);
+        util::metrics::Add(ret == 0 ? util::metrics::kMounts : util::metrics::kMountFailures);
+        LL_PROBE2(mount__done, step.mount.destination.c_str(), ret);
+        return ret;
+    }
+
+    int DoMountStep(const MountStep &step) const
+    {
+        int ret = -1;
+        auto const &m = step.mount;
+        auto const &source = step.source;
+        auto host_dest_full_path = driver_->HostPath(util::fs::path(m.destination));
+        auto root = driver_->HostPath(util::fs::path("/"));
+
         auto data = util::str_vec_join(m.data, ',');
         auto real_data = data;
         auto real_flags = m.flags;
 
+        if (0 == DoMountWithNewApi(step)) {
+            return 0;
+        }
+
         switch (m.fsType) {
         case Mount::Bind:
             // make sure m.flags always have MS_BIND
@@ -144,12 +319,16 @@ public:
                                                      nullptr, real_flags, nullptr);
                     if (ret == 0) {
                         sysfs_is_binded = true;
+                        util::metrics::Add(util::metrics::kMountFallbacks);
                     }
                 } else if (m.fsType == Mount::Mqueue) {
                     real_flags = MS_BIND | MS_REC;
                     real_data = "";
                     ret = util::fs::do_mount_with_fd(root.c_str(), "/dev/mqueue", host_dest_full_path.string().c_str(),
                                                      nullptr, real_flags, nullptr);
+                    if (ret == 0) {
+                        util::metrics::Add(util::metrics::kMountFallbacks);
+                    }
                 }
             }
             break;
@@ -169,8 +348,8 @@ public:
         if (EXIT_SUCCESS != ret) {
             logErr() << "mount" << source << "to" << host_dest_full_path << "failed:" << util::RetErrString(ret)
                      << "\nmount args is:" << m.type << real_flags << real_data;
-            if (is_path) {
-                logErr() << "source file type is: 0x" << std::hex << (source_stat.st_mode & S_IFMT);
+            if (step.isPath) {
+                logErr() << "source file type is: 0x" << std::hex << step.sourceType;
                 DUMP_FILE_INFO(source);
             }
             DUMP_FILE_INFO(host_dest_full_path.string());
@@ -179,8 +358,78 @@ public:
         return ret;
     }
 
+    // mount with open_tree/fsopen and move_mount to an fd resolved beneath the rootfs, return -1 to fallback to
+    // DoMount, which also handles remount, propagation and the sysfs/mqueue retry.
+    int DoMountWithNewApi(const MountStep &step) const
+    {
+        auto const &m = step.mount;
+        const unsigned long int attrFlags =
+            MS_RDONLY | MS_NOSUID | MS_NODEV | MS_NOEXEC | MS_NOATIME | MS_NODIRATIME | MS_RELATIME | MS_STRICTATIME;
+
+        if (!util::fs::new_mount_api_available()) {
+            return -1;
+        }
+
+        if (rootFd < 0 && OpenRootFd() < 0) {
+            return -1;
+        }
+
+        auto destination = util::fs::path(m.destination).string();
+        auto target = destination == "/" ? std::string(".") : destination.substr(1);
+        int ret = -1;
+
+        switch (m.fsType) {
+        case Mount::Bind:
+            if (!m.data.empty() || (m.flags & ~(attrFlags | MS_BIND | MS_REC))) {
+                return -1;
+            }
+            ret = util::fs::do_bind_with_tree(rootFd, step.source.c_str(), target.c_str(), m.flags);
+            if (0 == ret && step.source == "/sys") {
+                sysfs_is_binded = true;
+            }
+            break;
+        case Mount::Proc:
+        case Mount::Devpts:
+        case Mount::Mqueue:
+        case Mount::Tmpfs:
+        case Mount::Sysfs:
+            if (m.flags & ~attrFlags) {
+                return -1;
+            }
+            ret = util::fs::do_mount_with_fsopen(rootFd, m.type.c_str(), step.source.c_str(), target.c_str(), m.flags,
+                                                 m.data);
+            break;
+        default:
+            return -1;
+        }
+
+        if (0 != ret) {
+            logDbg() << "new mount api failed on" << m.destination << util::errnoString() << ", fallback";
+            return -1;
+        }
+
+        // the old root is covered now
+        if (destination == "/") {
+            close(rootFd);
+            rootFd = -1;
+        }
+        return 0;
+    }
+
+    int OpenRootFd() const
+    {
+        if (rootFd < 0) {
+            rootFd = open(driver_->HostPath(util::fs::path("/")).string().c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        }
+        return rootFd;
+    }
+
     std::unique_ptr<FilesystemDriver> driver_;
-    mutable bool sysfs_is_binded = false;
+    mutable std::atomic<bool> sysfs_is_binded {false};
+    mutable bool driverReady = false;
+    mutable int driverStatus = 0;
+    // rootfs on host, targets of the new mount api are resolved beneath it
+    mutable int rootFd = -1;
 };
 
 HostMount::HostMount()
@@ -193,6 +442,26 @@ int HostMount::MountNode(const struct Mount &m)
     return dd_ptr->MountNode(m);
 }
 
+MountPlan HostMount::Plan(std::vector<Mount> mounts) const
+{
+    for (auto &m : mounts) {
+        if (!m.source.empty() && m.source[0] == '/') {
+            m.source = dd_ptr->driver_->HostSource(util::fs::path(m.source)).string();
+        }
+    }
+    return MountPlan::Compile(mounts);
+}
+
+int HostMount::Execute(const MountPlan &plan)
+{
+    return dd_ptr->Execute(plan);
+}
+
+int HostMount::Wait()
+{
+    return dd_ptr->WaitDriver();
+}
+
 int HostMount::Setup(FilesystemDriver *driver)
 {
     if (nullptr == driver) {
@@ -201,6 +470,8 @@ int HostMount::Setup(FilesystemDriver *driver)
     }
 
     dd_ptr->driver_ = std::unique_ptr<FilesystemDriver>(driver);
+    dd_ptr->driverReady = false;
+    dd_ptr->driverStatus = 0;
     return dd_ptr->driver_->Setup();
 }
 
@@ -13,6 +13,7 @@ namespace linglong {
 
 class FilesystemDriver;
 class HostMountPrivate;
+class MountPlan;
 
 class HostMount
 {
@@ -22,8 +23,16 @@ public:
 
     int Setup(FilesystemDriver *driver);
 
+    // block until the filesystem of the driver is mounted, -1 if it failed to
+    int Wait();
+
     int MountNode(const Mount &m);
 
+    // compile mounts to a plan, sources are mapped with the driver
+    MountPlan Plan(std::vector<Mount> mounts) const;
+
+    int Execute(const MountPlan &plan);
+
 private:
     std::unique_ptr<HostMountPrivate> dd_ptr;
 };
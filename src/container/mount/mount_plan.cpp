@@ -0,0 +1,343 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "mount_plan.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <deque>
+#include <set>
+
+namespace linglong {
+
+// util::fs::do_mount_with_fd: open, readlink, mount, close
+static const int kSyscallsPerMount = 4;
+// MAXSYMLINKS of linux
+static const int kMaxSymlinks = 40;
+
+// return true if path is parent or is the same as other
+static bool covers(const std::string &parent, const std::string &path)
+{
+    if (parent == "/" || parent == path) {
+        return true;
+    }
+    return path.size() > parent.size() && path.compare(0, parent.size(), parent) == 0 && path[parent.size()] == '/';
+}
+
+static size_t depth(const std::string &path)
+{
+    return std::count(path.begin(), path.end(), '/') - (path == "/" ? 1 : 0);
+}
+
+MountPlan MountPlan::Compile(const std::vector<Mount> &mounts)
+{
+    MountPlan plan;
+
+    std::vector<std::string> destinations;
+    for (auto const &m : mounts) {
+        destinations.push_back(util::fs::path(m.destination).string());
+    }
+
+    // a mount is shadowed if a later one lands on the same destination or on its parent, remount only changes flags
+    for (size_t i = 0; i < mounts.size(); ++i) {
+        bool shadowed = false;
+        for (size_t j = i + 1; j < mounts.size(); ++j) {
+            if ((mounts[j].flags & MS_REMOUNT) == 0 && covers(destinations[j], destinations[i])) {
+                plan.dropped.push_back({mounts[i], destinations[j]});
+                shadowed = true;
+                break;
+            }
+        }
+        if (shadowed) {
+            continue;
+        }
+
+        MountStep step;
+        step.mount = mounts[i];
+        step.mount.destination = destinations[i];
+        step.source = mounts[i].source;
+        plan.steps.push_back(step);
+    }
+
+    // after dropping shadowed mounts, a parent always goes before its children, so sort by depth keeps the semantic.
+    std::stable_sort(plan.steps.begin(), plan.steps.end(), [](const MountStep &a, const MountStep &b) {
+        return depth(a.mount.destination) < depth(b.mount.destination);
+    });
+
+    // paths known to exist since the last mount covering them
+    std::set<std::string> created;
+
+    for (auto &step : plan.steps) {
+        auto const &m = step.mount;
+        struct stat st {
+        };
+
+        if (!step.source.empty() && step.source[0] == '/') {
+            step.isPath = true;
+            if (0 == lstat(step.source.c_str(), &st)) {
+                step.sourceType = st.st_mode & S_IFMT;
+            } else if (m.fsType == Mount::Bind) {
+                step.sourceMissing = true;
+            }
+        }
+
+        switch (step.sourceType) {
+        case S_IFLNK:
+            step.source = util::fs::read_symlink(util::fs::path(step.source)).string();
+            step.touch = true;
+            break;
+        case S_IFCHR:
+        case S_IFSOCK:
+        case S_IFREG:
+            step.touch = true;
+            break;
+        default:
+            break;
+        }
+
+        auto components = util::fs::path(m.destination).components();
+        if (step.touch && !components.empty()) {
+            components.pop_back();
+        }
+
+        int legacy = 1 + static_cast<int>(components.size());
+        std::string dir;
+        for (auto const &component : components) {
+            dir += "/" + component;
+            if (created.insert(dir).second) {
+                step.directories.push_back(dir);
+                ++legacy;
+            }
+        }
+
+        if (m.fsType == Mount::Bind && !(step.mount.data.empty() && (m.flags & ~(MS_BIND | MS_REC | MS_REMOUNT)) == 0)) {
+            step.mountCalls = 2;
+        }
+        legacy += (step.touch ? 3 : 0) + step.mountCalls * kSyscallsPerMount;
+        plan.legacySyscalls += legacy;
+
+        // the new filesystem hides everything below the mount point
+        for (auto it = created.begin(); it != created.end();) {
+            if (covers(m.destination, *it) && *it != m.destination) {
+                it = created.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        created.insert(m.destination);
+    }
+
+    return plan;
+}
+
+std::vector<std::vector<size_t>> MountPlan::Subtrees() const
+{
+    std::vector<std::vector<size_t>> groups;
+    std::vector<size_t> groupOf(steps.size());
+
+    for (size_t i = 0; i < steps.size(); ++i) {
+        // steps are sorted by depth, the nearest covering mount is the last one found
+        bool found = false;
+        for (size_t j = i; j-- > 0;) {
+            if (covers(steps[j].mount.destination, steps[i].mount.destination)) {
+                groupOf[i] = groupOf[j];
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            groupOf[i] = groups.size();
+            groups.push_back({});
+        }
+        groups[groupOf[i]].push_back(i);
+    }
+
+    return groups;
+}
+
+const MountStep *MountPlan::MountOf(const std::string &path) const
+{
+    // steps are sorted by depth, the nearest covering mount is the last one found
+    for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+        if (covers(it->mount.destination, path)) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+bool MountPlan::LinkBelow(const std::string &path) const
+{
+    // the mount path lives on, not one mounted on path
+    const MountStep *below = nullptr;
+    for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+        if (it->mount.destination != path && covers(it->mount.destination, path)) {
+            below = &*it;
+            break;
+        }
+    }
+    // a new filesystem has no symlink
+    if (!below || below->mount.fsType != Mount::Bind || !below->isPath || below->sourceMissing) {
+        return false;
+    }
+
+    auto const &destination = below->mount.destination;
+    auto host = below->source + (destination == "/" ? path : path.substr(destination.size()));
+    struct stat st {
+    };
+    return lstat(host.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+}
+
+int MountPlan::Resolve(const std::string &path, std::string &hostPath, const MountStep **mountedBy) const
+{
+    auto components = util::fs::path(path).components();
+    std::deque<std::string> remaining(components.begin(), components.end());
+    std::string current;
+    std::string host;
+    const MountStep *step = nullptr;
+    int followed = 0;
+
+    while (!remaining.empty()) {
+        auto name = remaining.front();
+        remaining.pop_front();
+        if (name == ".") {
+            continue;
+        }
+        if (name == "..") {
+            current = current.substr(0, current.rfind('/'));
+            host.clear();
+            continue;
+        }
+
+        auto next = current + "/" + name;
+        // mount points and their parents are directories created by the plan, they may not exist yet
+        bool mountPoint = std::any_of(steps.begin(), steps.end(), [&](const MountStep &s) {
+            return s.mount.destination != next && covers(next, s.mount.destination);
+        });
+        if (mountPoint) {
+            // unless it's a symlink, which mount follows to a place the plan doesn't know
+            if (links.count(next) || LinkBelow(next)) {
+                return -1;
+            }
+            current = next;
+            host.clear();
+            continue;
+        }
+
+        step = MountOf(next);
+        std::string target;
+        if (!step) {
+            // nothing else lives on the root tmpfs
+            auto link = links.find(next);
+            if (link == links.end()) {
+                return 0;
+            }
+            target = link->second;
+        } else if (step->mount.fsType != Mount::Bind || !step->isPath) {
+            return -1;
+        } else if (step->sourceMissing) {
+            return 0;
+        } else {
+            auto const &destination = step->mount.destination;
+            host = step->source + (destination == "/" ? next : next.substr(destination.size()));
+
+            struct stat st {
+            };
+            if (lstat(host.c_str(), &st) != 0) {
+                return (errno == ENOENT || errno == ENOTDIR) ? 0 : -1;
+            }
+            if (S_ISLNK(st.st_mode)) {
+                char buf[PATH_MAX];
+                auto size = readlink(host.c_str(), buf, sizeof(buf));
+                if (size < 0) {
+                    return -1;
+                }
+                target.assign(buf, static_cast<size_t>(size));
+            }
+        }
+
+        if (!target.empty()) {
+            if (++followed > kMaxSymlinks) {
+                return -1;
+            }
+            // an absolute target starts from the root of the container
+            if (target[0] == '/') {
+                current.clear();
+            }
+            auto targetComponents = util::fs::path(target).components();
+            remaining.insert(remaining.begin(), targetComponents.begin(), targetComponents.end());
+            host.clear();
+            continue;
+        }
+
+        current = next;
+    }
+
+    // a directory created by the plan
+    if (host.empty()) {
+        return -1;
+    }
+
+    hostPath = host;
+    if (mountedBy) {
+        *mountedBy = step;
+    }
+    return 1;
+}
+
+int MountPlan::SyscallCount() const
+{
+    int count = 0;
+    for (auto const &step : steps) {
+        count += step.isPath ? 1 : 0;
+        count += static_cast<int>(step.directories.size());
+        count += step.touch ? 2 : 0;
+        count += step.mountCalls * kSyscallsPerMount;
+    }
+    return count;
+}
+
+int MountPlan::LegacySyscallCount() const
+{
+    return legacySyscalls;
+}
+
+void MountPlan::Dump(std::ostream &out) const
+{
+    out << "mount plan: " << steps.size() << " steps, " << dropped.size() << " dropped, " << SyscallCount()
+        << " syscalls (mount one by one: ~" << LegacySyscallCount() << ")" << std::endl;
+
+    int index = 0;
+    for (auto const &step : steps) {
+        out << "[" << index++ << "] " << step.mount.type << " " << step.source << " -> " << step.mount.destination
+            << " flags=0x" << std::hex << step.mount.flags << std::dec;
+        if (!step.mount.data.empty()) {
+            out << " data=" << util::str_vec_join(step.mount.data, ',');
+        }
+        if (!step.directories.empty()) {
+            out << " mkdir=" << util::str_vec_join(step.directories, ' ');
+        }
+        if (step.touch) {
+            out << " touch";
+        }
+        out << " mount=" << step.mountCalls;
+        if (step.sourceMissing) {
+            out << " (source missing)";
+        }
+        out << std::endl;
+    }
+
+    for (auto const &d : dropped) {
+        out << "dropped: " << d.mount.type << " " << d.mount.source << " -> " << d.mount.destination
+            << " shadowed by " << d.by << std::endl;
+    }
+}
+
+} // namespace linglong
@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_CONTAINER_MOUNT_MOUNT_PLAN_H_
+#define LINGLONG_BOX_SRC_CONTAINER_MOUNT_MOUNT_PLAN_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <ostream>
+
+#include "util/oci_runtime.h"
+
+namespace linglong {
+
+struct MountStep {
+    Mount mount;
+    // host path of source, symlink is resolved to its target
+    std::string source;
+    bool isPath = false;
+    // lstat result of source, S_IFMT bits only, 0 if source is not a path
+    mode_t sourceType = 0;
+    bool sourceMissing = false;
+
+    // directories to create in container before mounting, parent first
+    util::str_vec directories;
+    // create an empty file at destination as mount point
+    bool touch = false;
+    // 1 for most mounts, 2 for bind with options which need a remount
+    int mountCalls = 1;
+};
+
+/*!
+ * MountPlan compiles the mounts of a container into an ordered list of steps:
+ *  - a mount covered by a later mount at the same or a parent destination is dropped
+ *  - parent destination goes before children
+ *  - every directory or file mount point is created exactly once, and only after the mount it lives on
+ * The executor (HostMount::Execute) then runs the steps without any extra lstat.
+ */
+class MountPlan
+{
+public:
+    // sources are host paths, see FilesystemDriver::HostSource
+    static MountPlan Compile(const std::vector<Mount> &mounts);
+
+    const std::vector<MountStep> &Steps() const { return steps; }
+
+    // indexes of steps grouped by independent subtree, in plan order. The first step of a group is the root, the other
+    // steps land on mounts of the same group. Groups share nothing but the directories of their roots, so they can be
+    // mounted concurrently once those directories exist.
+    std::vector<std::vector<size_t>> Subtrees() const;
+
+    // a symlink created in the container after the plan is executed, such as those of PrepareLinks, known by Resolve
+    void Link(const std::string &target, const std::string &path) { links[path] = target; }
+
+    // resolve path in the container to the host file it will be mounted from, before the plan is executed. Symlinks are
+    // followed as in the container. Return 1 and set hostPath and the step of the mount it lives on if path will exist,
+    // 0 if it will not, -1 if it's unknown, such as a path on a tmpfs, a symlink loop, or a symlink on the way to a
+    // mount point, which makes the mount land elsewhere.
+    int Resolve(const std::string &path, std::string &hostPath, const MountStep **mountedBy = nullptr) const;
+
+    // syscall count to run this plan, and an estimation of mounting the same list one by one with MountNode
+    int SyscallCount() const;
+    int LegacySyscallCount() const;
+
+    void Dump(std::ostream &out) const;
+
+private:
+    // the last mount covering path, nullptr if it's on the root tmpfs
+    const MountStep *MountOf(const std::string &path) const;
+    // path is a symlink on the bind mount below it
+    bool LinkBelow(const std::string &path) const;
+
+    struct Dropped {
+        Mount mount;
+        std::string by;
+    };
+
+    std::vector<MountStep> steps;
+    std::vector<Dropped> dropped;
+    std::map<std::string, std::string> links;
+    int legacySyscalls = 0;
+};
+
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_CONTAINER_MOUNT_MOUNT_PLAN_H_ */
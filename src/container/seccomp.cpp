@@ -6,8 +6,18 @@
 
 #include "seccomp.h"
 
+#include <linux/seccomp.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <seccomp.h>
 
+#include "util/runtime_cache.h"
+
 namespace {
 
 #define SYSCALL_PAIR(SYSCALL) \
@@ -62,12 +72,20 @@ int toSyscallNumber(const std::string &name)
 
 namespace linglong {
 
-int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp)
-{
-    if (!seccomp.has_value()) {
-        return 0;
-    }
+static const char kSeccompCacheMagic[4] = {'L', 'L', 'S', 'B'};
+static const uint32_t kSeccompCacheVersion = 1;
 
+struct SeccompCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// build the filter with libseccomp, throw on error
+static scmp_filter_ctx BuildFilter(const linglong::Seccomp &seccomp)
+{
     static const std::map<std::string, int> seccompActionMap = {
         {"SCMP_ACT_KILL", SCMP_ACT_KILL},          {"SCMP_ACT_TRAP", SCMP_ACT_TRAP},
         {"SCMP_ACT_ERRNO", SCMP_ACT_ERRNO(EPERM)}, {"SCMP_ACT_TRACE", SCMP_ACT_TRACE(EPERM)},
@@ -92,16 +110,15 @@ int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp)
     };
 
     int ret;
-    scmp_filter_ctx ctx = nullptr;
+    auto defaultAction = seccompActionMap.at(seccomp.defaultAction);
 
-    try {
-        auto defaultAction = seccompActionMap.at(seccomp->defaultAction);
+    scmp_filter_ctx ctx = seccomp_init(defaultAction);
+    if (ctx == nullptr) {
+        throw std::runtime_error(util::errnoString() + " seccomp_init=" + seccomp.defaultAction);
+    }
 
-        ctx = seccomp_init(defaultAction);
-        if (ctx == nullptr) {
-            throw std::runtime_error(util::errnoString() + " seccomp_init=" + seccomp->defaultAction);
-        }
-        for (auto const &architecture : seccomp->architectures) {
+    try {
+        for (auto const &architecture : seccomp.architectures) {
             auto scmpArch = seccompArchMap.at(architecture);
             if (seccomp_arch_exist(ctx, scmpArch) == -EEXIST) {
                 ret = seccomp_arch_add(ctx, scmpArch);
@@ -111,7 +128,7 @@ int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp)
             }
         }
 
-        for (auto const &syscall : seccomp->syscalls) {
+        for (auto const &syscall : seccomp.syscalls) {
             auto action = seccompActionMap.at(syscall.action);
             auto argc = syscall.args.size();
             auto args = toScmpArgCmpArray(syscall.args);
@@ -125,6 +142,25 @@ int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp)
                 }
             }
         }
+    } catch (...) {
+        seccomp_release(ctx);
+        throw;
+    }
+
+    return ctx;
+}
+
+int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp)
+{
+    if (!seccomp.has_value()) {
+        return 0;
+    }
+
+    int ret;
+    scmp_filter_ctx ctx = nullptr;
+
+    try {
+        ctx = BuildFilter(*seccomp);
         ret = seccomp_load(ctx);
     } catch (const std::exception &e) {
         logErr() << "config seccomp failed:" << e.what();
@@ -134,10 +170,181 @@ int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp)
         ret = -1;
     }
 
-    if (!ctx) {
+    if (ctx) {
         seccomp_release(ctx);
     }
     return ret;
 }
 
+// everything the generated program depends on
+static uint64_t SeccompKey(const linglong::Seccomp &seccomp)
+{
+    auto version = seccomp_version();
+    std::string key = util::format("%u %u.%u.%u %s", seccomp_arch_native(), version->major, version->minor,
+                                   version->micro, seccomp.defaultAction.c_str());
+    for (auto const &architecture : seccomp.architectures) {
+        key += " " + architecture;
+    }
+    for (auto const &syscall : seccomp.syscalls) {
+        key += "\n" + syscall.action + ":" + util::str_vec_join(syscall.names, ',');
+        for (auto const &arg : syscall.args) {
+            key += util::format(" %u/%llu/%llu/%s", arg.index, static_cast<unsigned long long>(arg.value),
+                                static_cast<unsigned long long>(arg.valueTwo), arg.op.c_str());
+        }
+    }
+    return util::RuntimeCache::Hash(key);
+}
+
+static bool LoadSeccompCache(const std::string &path, uint64_t key, std::vector<struct sock_filter> &program)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st {
+    };
+    SeccompCacheHeader header = {};
+    bool hit = 0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_uid == getuid()
+        && read(fd, &header, sizeof(header)) == sizeof(header)
+        && 0 == memcmp(header.magic, kSeccompCacheMagic, sizeof(header.magic)) && header.version == kSeccompCacheVersion
+        && header.key == key && header.count > 0 && header.count <= BPF_MAXINSNS
+        && static_cast<uint64_t>(st.st_size) == sizeof(header) + header.count * sizeof(struct sock_filter);
+
+    if (hit) {
+        program.resize(header.count);
+        auto size = header.count * sizeof(struct sock_filter);
+        hit = read(fd, program.data(), size) == static_cast<ssize_t>(size);
+    }
+    close(fd);
+
+    if (!hit) {
+        program.clear();
+    }
+    return hit;
+}
+
+static void StoreSeccompCache(const std::string &path, uint64_t key, const std::vector<struct sock_filter> &program)
+{
+    SeccompCacheHeader header = {};
+    memcpy(header.magic, kSeccompCacheMagic, sizeof(header.magic));
+    header.version = kSeccompCacheVersion;
+    header.key = key;
+    header.count = static_cast<uint32_t>(program.size());
+
+    std::string data(reinterpret_cast<const char *>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char *>(program.data()), program.size() * sizeof(struct sock_filter));
+
+    auto tmp = util::format("%s.%d", path.c_str(), getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    auto written = write(fd, data.c_str(), data.size());
+    close(fd);
+
+    if (written != static_cast<ssize_t>(data.size()) || 0 != rename(tmp.c_str(), path.c_str())) {
+        logWan() << "write seccomp cache" << path << "failed" << util::errnoString();
+        unlink(tmp.c_str());
+    }
+}
+
+// generate the program with libseccomp and read it back
+static int ExportSeccomp(const linglong::Seccomp &seccomp, std::vector<struct sock_filter> &program)
+{
+    scmp_filter_ctx ctx = nullptr;
+    int fd = -1;
+    int ret = -1;
+
+    try {
+        ctx = BuildFilter(seccomp);
+
+        fd = static_cast<int>(syscall(SYS_memfd_create, "ll-box-seccomp", MFD_CLOEXEC));
+        if (fd < 0) {
+            throw std::runtime_error(util::errnoString() + " memfd_create");
+        }
+
+        ret = seccomp_export_bpf(ctx, fd);
+        if (ret != 0) {
+            throw std::runtime_error(util::RetErrString(ret) + " seccomp_export_bpf");
+        }
+
+        struct stat st {
+        };
+        fstat(fd, &st);
+        program.resize(st.st_size / sizeof(struct sock_filter));
+        auto size = program.size() * sizeof(struct sock_filter);
+        if (program.empty() || pread(fd, program.data(), size, 0) != static_cast<ssize_t>(size)) {
+            throw std::runtime_error(util::errnoString() + " read exported bpf");
+        }
+        ret = 0;
+    } catch (const std::exception &e) {
+        logErr() << "prepare seccomp failed:" << e.what();
+        program.clear();
+        ret = -1;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (ctx) {
+        seccomp_release(ctx);
+    }
+    return ret;
+}
+
+int PrepareSeccomp(const tl::optional<linglong::Seccomp> &seccomp, const std::string &cacheDir,
+                   std::vector<struct sock_filter> &program)
+{
+    program.clear();
+    if (!seccomp.has_value()) {
+        return 0;
+    }
+
+    auto key = SeccompKey(*seccomp);
+    auto path = util::format("%s/seccomp-%016llx.bpf", cacheDir.c_str(), static_cast<unsigned long long>(key));
+
+    // the cache dir is the user's, see RuntimeCache::DefaultDir
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+
+    int ret = 0;
+    if (cacheDir.empty() || !LoadSeccompCache(path, key, program)) {
+        ret = ExportSeccomp(*seccomp, program);
+        if (ret == 0 && !cacheDir.empty()) {
+            StoreSeccompCache(path, key, program);
+        }
+    }
+
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    return ret;
+}
+
+int LoadSeccompProgram(const std::vector<struct sock_filter> &program)
+{
+    if (program.empty()) {
+        return 0;
+    }
+
+    // what seccomp_load does by default, and the kernel refuses the filter without it if not privileged
+    if (0 != prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
+        logErr() << "set no new privs failed" << util::errnoString();
+        return -1;
+    }
+
+    struct sock_fprog prog = {};
+    prog.len = static_cast<unsigned short>(program.size());
+    prog.filter = const_cast<struct sock_filter *>(program.data());
+
+    if (0 != syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog)) {
+        logErr() << "load seccomp failed" << util::errnoString();
+        return -1;
+    }
+    return 0;
+}
+
 } // namespace linglong
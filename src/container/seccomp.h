@@ -7,10 +7,20 @@
 #ifndef LINGLONG_BOX_SRC_CONTAINER_SECCOMP_H_
 #define LINGLONG_BOX_SRC_CONTAINER_SECCOMP_H_
 
+#include <linux/filter.h>
+
 #include "util/oci_runtime.h"
 
 namespace linglong {
 int ConfigSeccomp(const tl::optional<linglong::Seccomp> &seccomp);
-}
+
+// compile seccomp to a bpf program, it's cached in cacheDir by the hash of seccomp and the native arch.
+// program is empty if seccomp is not set. cacheDir may be empty to disable the cache, it is used with the real uid.
+int PrepareSeccomp(const tl::optional<linglong::Seccomp> &seccomp, const std::string &cacheDir,
+                   std::vector<struct sock_filter> &program);
+
+// install a program from PrepareSeccomp, do nothing if it's empty
+int LoadSeccompProgram(const std::vector<struct sock_filter> &program);
+} // namespace linglong
 
 #endif /* LINGLONG_BOX_SRC_CONTAINER_SECCOMP_H_ */
@@ -0,0 +1,441 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "zygote.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <utility>
+
+#include "util/logger.h"
+#include "util/message_reader.h"
+#include "util/oci_runtime.h"
+#include "container/container.h"
+
+namespace linglong {
+
+// every distinct config keeps its own pool, drop the least recently used one beyond this
+static const size_t kMaxPools = 16;
+
+// send fd with SCM_RIGHTS, the one byte payload tells the client the launch succeeded
+static int SendFd(int socket, int fd)
+{
+    char payload = 'o';
+    struct iovec iov = {&payload, sizeof(payload)};
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control = {};
+
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return sendmsg(socket, &msg, MSG_NOSIGNAL) == sizeof(payload) ? 0 : -1;
+}
+
+struct WarmContainer {
+    pid_t pid = -1;
+    // the other end is the reader of the container
+    std::unique_ptr<util::MessageReader> control;
+};
+
+struct Pool {
+    Runtime runtime;
+    // the request without "process", pools are keyed by its hash
+    std::string config;
+    std::deque<WarmContainer> warm;
+    uint64_t lastUsed = 0;
+    // a container with dbus proxy binds a fixed socket path, only one of them can exist
+    bool poolable = true;
+};
+
+struct ZygotePrivate {
+public:
+    ZygotePrivate(std::string path, int size, const Option &opt, Zygote::Launcher launch)
+        : socketPath(std::move(path))
+        , poolSize(size)
+        , option(opt)
+        , launcher(std::move(launch))
+    {
+        option.deferProcess = true;
+    }
+
+    std::string socketPath;
+    int poolSize;
+    Option option;
+    Zygote::Launcher launcher;
+
+    int listenFd = -1;
+    int signalFd = -1;
+    int epfd = -1;
+    int clientFd = -1;
+    // connections whose request is not fully read yet
+    std::map<int, std::unique_ptr<util::MessageReader>> clients;
+
+    uint64_t requestCount = 0;
+
+    std::map<size_t, Pool> pools;
+    // pools handed a container out, refilled when the event loop is idle
+    std::set<size_t> refills;
+
+public:
+    int Spawn(const Runtime &config, WarmContainer &warm)
+    {
+        int sv[2];
+        if (0 != socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+            logErr() << "socketpair failed" << util::errnoString();
+            return -1;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            logErr() << "fork failed" << util::errnoString();
+            close(sv[0]);
+            close(sv[1]);
+            return -1;
+        }
+
+        if (0 == pid) {
+            // config may refer to a pool, copy it before clear
+            Runtime runtime = config;
+            // each container has a cgroup of its own, the limits, stats and freezer of one must not cover the others
+            if (!runtime.linux.cgroupsPath.empty()) {
+                runtime.linux.cgroupsPath += util::format("-%d", getpid());
+            }
+
+            close(sv[0]);
+            // do not leak the control channels of other containers, or they will never see EOF.
+            pools.clear();
+            refills.clear();
+            clients.clear();
+            close(listenFd);
+            close(signalFd);
+            close(epfd);
+            if (clientFd >= 0) {
+                close(clientFd);
+            }
+
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGCHLD);
+            sigaddset(&mask, SIGTERM);
+            sigaddset(&mask, SIGINT);
+            sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+
+            std::unique_ptr<util::MessageReader> reader(new util::MessageReader(sv[1]));
+            int ret = -1;
+            try {
+                if (launcher) {
+                    ret = launcher(runtime, std::move(reader), option);
+                } else {
+                    Container container(runtime, std::move(reader));
+                    ret = container.Start(option);
+                }
+            } catch (const std::exception &e) {
+                logErr() << "start warm container failed:" << e.what();
+            }
+            exit(ret);
+        }
+
+        close(sv[1]);
+        warm.pid = pid;
+        warm.control.reset(new util::MessageReader(sv[0]));
+        logDbg() << "spawn warm container" << pid;
+        return 0;
+    }
+
+    // spawn one container for a pool waiting to be refilled, one at a time so that a request is not held up
+    void RefillOne()
+    {
+        auto key = *refills.begin();
+        auto it = pools.find(key);
+        if (it == pools.end() || !it->second.poolable || it->second.warm.size() >= static_cast<size_t>(poolSize)) {
+            refills.erase(key);
+            return;
+        }
+
+        WarmContainer warm;
+        if (0 != Spawn(it->second.runtime, warm)) {
+            refills.erase(key);
+            return;
+        }
+        it->second.warm.push_back(std::move(warm));
+    }
+
+    // take a container from pool which is still alive, start a cold one if there is none.
+    int Take(Pool &pool, WarmContainer &warm)
+    {
+        while (!pool.warm.empty()) {
+            warm = std::move(pool.warm.front());
+            pool.warm.pop_front();
+            if (0 == waitpid(warm.pid, nullptr, WNOHANG)) {
+                return 0;
+            }
+            logWan() << "warm container" << warm.pid << "is dead";
+        }
+
+        logInf() << "pool is empty, start a cold container";
+        return Spawn(pool.runtime, warm);
+    }
+
+    void Reap()
+    {
+        int wstatus;
+        pid_t pid;
+        while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+            for (auto &pool : pools) {
+                auto &warm = pool.second.warm;
+                for (auto it = warm.begin(); it != warm.end(); ++it) {
+                    if (it->pid == pid) {
+                        logWan() << "warm container" << pid << "exited with" << wstatus;
+                        warm.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    void EvictPools()
+    {
+        while (pools.size() > kMaxPools) {
+            auto lru = pools.begin();
+            for (auto it = pools.begin(); it != pools.end(); ++it) {
+                if (it->second.lastUsed < lru->second.lastUsed) {
+                    lru = it;
+                }
+            }
+            // closing the control channel makes the warm containers exit
+            pools.erase(lru);
+        }
+    }
+
+    // read what a client sent, the request is handled once it's complete. A client never blocks the event loop.
+    void ReadClient(int fd)
+    {
+        auto it = clients.find(fd);
+        int ret = it->second->fill();
+        if (ret < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (ret > 0 && !it->second->pending()) {
+            return;
+        }
+
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        auto client = std::move(it->second);
+        clients.erase(it);
+        if (ret <= 0) {
+            logWan() << "client closed before its request" << (ret < 0 ? util::errnoString() : "");
+            return;
+        }
+        HandleClient(*client);
+    }
+
+    int HandleClient(util::MessageReader &client)
+    {
+        nlohmann::json json;
+        Runtime runtime;
+        try {
+            json = client.read();
+            runtime = json.get<Runtime>();
+        } catch (const std::exception &e) {
+            logErr() << "invalid request:" << e.what();
+            return -1;
+        }
+
+        // the connection must not leak into containers spawned below
+        clientFd = client.fd;
+
+        auto process = json.at("process");
+        auto config = json;
+        config.erase("process");
+        auto dump = config.dump();
+        auto key = std::hash<std::string>()(dump);
+
+        auto it = pools.find(key);
+        if (it == pools.end()) {
+            Pool pool;
+            pool.runtime = runtime;
+            pool.config = dump;
+            pool.poolable = !(runtime.annotations.has_value() && runtime.annotations->dbus_proxy_info.has_value()
+                              && runtime.annotations->dbus_proxy_info->enable);
+            it = pools.insert(std::make_pair(key, std::move(pool))).first;
+        }
+
+        WarmContainer warm;
+        int ret;
+        if (it->second.config != dump) {
+            // another config with the same hash, its containers are not built from this one
+            logWan() << "config hash collides with a pool, start a cold container";
+            ret = Spawn(runtime, warm);
+        } else {
+            it->second.lastUsed = ++requestCount;
+            ret = Take(it->second, warm);
+        }
+        if (0 != ret) {
+            clientFd = -1;
+            return -1;
+        }
+
+        // the init of container is waiting for a Process on its reader
+        warm.control->write(process.dump());
+        if (0 != SendFd(client.fd, warm.control->fd)) {
+            logErr() << "send container fd failed" << util::errnoString();
+        }
+        logInf() << "hand out container" << warm.pid;
+
+        if (it->second.config == dump) {
+            refills.insert(key);
+            EvictPools();
+        }
+        clientFd = -1;
+        return 0;
+    }
+};
+
+Zygote::Zygote(std::string socketPath, int poolSize, const Option &option, Launcher launcher)
+    : dd_ptr(new ZygotePrivate(std::move(socketPath), poolSize, option, std::move(launcher)))
+{
+}
+
+Zygote::~Zygote()
+{
+    if (dd_ptr->listenFd >= 0) {
+        close(dd_ptr->listenFd);
+        unlink(dd_ptr->socketPath.c_str());
+    }
+    if (dd_ptr->signalFd >= 0) {
+        close(dd_ptr->signalFd);
+    }
+    if (dd_ptr->epfd >= 0) {
+        close(dd_ptr->epfd);
+    }
+}
+
+int Zygote::Serve()
+{
+    auto &d = *dd_ptr;
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (d.socketPath.size() >= sizeof(addr.sun_path)) {
+        logErr() << "socket path too long:" << d.socketPath;
+        return -1;
+    }
+    strncpy(addr.sun_path, d.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    d.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (d.listenFd < 0) {
+        logErr() << "socket failed" << util::errnoString();
+        return -1;
+    }
+
+    unlink(d.socketPath.c_str());
+    // created without group and other access, a chmod after bind leaves a window to connect
+    auto oldMask = umask(077);
+    int ret = bind(d.listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    umask(oldMask);
+    if (0 != ret) {
+        logErr() << "bind" << d.socketPath << "failed" << util::errnoString();
+        return -1;
+    }
+
+    if (0 != listen(d.listenFd, SOMAXCONN)) {
+        logErr() << "listen failed" << util::errnoString();
+        return -1;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    d.signalFd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    d.epfd = epoll_create1(EPOLL_CLOEXEC);
+    auto epfd = d.epfd;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = d.listenFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, d.listenFd, &ev);
+    ev.data.fd = d.signalFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, d.signalFd, &ev);
+
+    logInf() << "zygote listen on" << d.socketPath << "pool size" << d.poolSize;
+
+    for (;;) {
+        struct epoll_event events[8];
+        util::Logger::Flush();
+        int count = epoll_wait(epfd, events, 8, d.refills.empty() ? -1 : 0);
+        if (count < 0 && errno != EINTR) {
+            logErr() << "epoll_wait failed" << util::errnoString();
+            break;
+        }
+        if (count == 0 && !d.refills.empty()) {
+            d.RefillOne();
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == d.signalFd) {
+                struct signalfd_siginfo info;
+                if (read(d.signalFd, &info, sizeof(info)) != sizeof(info)) {
+                    continue;
+                }
+                if (info.ssi_signo == SIGCHLD) {
+                    d.Reap();
+                } else {
+                    logInf() << "zygote terminated";
+                    return 0;
+                }
+            } else if (events[i].data.fd == d.listenFd) {
+                int client = accept4(d.listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (client < 0) {
+                    logWan() << "accept failed" << util::errnoString();
+                    continue;
+                }
+                struct ucred cred = {};
+                socklen_t len = sizeof(cred);
+                if (0 != getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) || cred.uid != getuid()) {
+                    logWan() << "reject client of uid" << cred.uid << "pid" << cred.pid;
+                    close(client);
+                    continue;
+                }
+                d.clients[client].reset(new util::MessageReader(client));
+                ev.data.fd = client;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, client, &ev);
+            } else if (d.clients.count(events[i].data.fd)) {
+                d.ReadClient(events[i].data.fd);
+            }
+        }
+    }
+
+    return -1;
+}
+
+} // namespace linglong
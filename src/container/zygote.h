@@ -0,0 +1,56 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_CONTAINER_ZYGOTE_H_
+#define LINGLONG_BOX_SRC_CONTAINER_ZYGOTE_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "container/container_option.h"
+#include "util/message_reader.h"
+#include "util/oci_runtime.h"
+
+namespace linglong {
+
+struct ZygotePrivate;
+
+/*!
+ * Zygote keeps containers warm: every container in the pool has finished namespace, rootfs and mount setup and its
+ * init is parked in the event loop, waiting for the Process to run.
+ *
+ * Clients connect to the unix socket and send a runtime json terminated by '\0', just as they would write it to the
+ * reader of ll-box. The zygote forwards "process" to a warm container built from the same config (everything but
+ * "process" must match) and sends the container's reader fd back with SCM_RIGHTS. From then on the client talks to
+ * the container as if it had started ll-box itself. The pool is refilled by the event loop when no request is waiting.
+ *
+ * A warm container gets a cgroup of its own, "-<pid>" is appended to linux.cgroupsPath, pid being the process which
+ * starts it.
+ *
+ * The socket is created 0700 and only connections from the real uid of the zygote are served. Requests are read
+ * without blocking, a slow client does not hold up the others.
+ *
+ * NOTE: warm containers inherit stdio of the zygote, configs with dbus proxy enabled are always started cold.
+ */
+class Zygote
+{
+public:
+    // run in the forked child to start a container, reader is its control channel. Container::Start by default.
+    typedef std::function<int(const Runtime &, std::unique_ptr<util::MessageReader>, const Option &)> Launcher;
+
+    explicit Zygote(std::string socketPath, int poolSize, const Option &option, Launcher launcher = nullptr);
+    ~Zygote();
+
+    int Serve();
+
+private:
+    std::unique_ptr<ZygotePrivate> dd_ptr;
+};
+
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_CONTAINER_ZYGOTE_H_ */
@@ -9,16 +9,129 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include <fstream>
 #include <iostream>
 
 #include "util/logger.h"
 #include "util/oci_runtime.h"
+#include "container/cgroup.h"
 #include "container/container.h"
 #include "container/container_option.h"
+#include "container/exec.h"
+#include "container/zygote.h"
 #include "util/message_reader.h"
+#include "util/runtime_cache.h"
+#include "util/trace.h"
+#include "util/trace_ring.h"
 
 extern linglong::Runtime loadBundle(int argc, char **argv);
 
+// ll-box --serve <socket path> [--pool <size>]
+static int serve(int argc, char **argv, const linglong::Option &option)
+{
+    if (argc < 3) {
+        logErr() << "usage: ll-box --serve <socket path> [--pool <size>]";
+        return -1;
+    }
+
+    int poolSize = 2;
+    if (argc == 5 && std::string(argv[3]) == "--pool") {
+        poolSize = atoi(argv[4]);
+    }
+
+    linglong::Zygote zygote(argv[2], poolSize, option);
+    return zygote.Serve();
+}
+
+// ll-box exec <pid> [--cwd <dir>] [--env <key=value>]... [--] <args>...
+static int exec(int argc, char **argv)
+{
+    linglong::Process process;
+    int i = 3;
+    for (; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--cwd" && i + 1 < argc) {
+            process.cwd = argv[++i];
+        } else if (arg == "--env" && i + 1 < argc) {
+            process.env.push_back(argv[++i]);
+        } else if (arg == "--") {
+            ++i;
+            break;
+        } else {
+            break;
+        }
+    }
+    for (; i < argc; ++i) {
+        process.args.push_back(argv[i]);
+    }
+
+    pid_t pid = argc > 2 ? atoi(argv[2]) : 0;
+    if (pid <= 0 || process.args.empty()) {
+        logErr() << "usage: ll-box exec <pid> [--cwd <dir>] [--env <key=value>]... [--] <args>...";
+        return -1;
+    }
+
+    return linglong::ExecInContainer(pid, process);
+}
+
+// ll-box update <pid> <resources.json|->, only the limits present in the json are changed
+static int update(int argc, char **argv)
+{
+    pid_t pid = argc > 3 ? atoi(argv[2]) : 0;
+    if (pid <= 0) {
+        logErr() << "usage: ll-box update <pid> <resources.json|->";
+        return -1;
+    }
+
+    // cgroups are changed with the permission of the user
+    if (0 != setgid(getgid()) || 0 != setuid(getuid())) {
+        logErr() << "drop privilege failed" << linglong::util::errnoString();
+        return -1;
+    }
+
+    try {
+        nlohmann::json json;
+        if (std::string(argv[3]) == "-") {
+            std::cin >> json;
+        } else {
+            std::ifstream(argv[3]) >> json;
+        }
+        // fail on a malformed json before touching the cgroup
+        json.get<linglong::Resources>();
+
+        linglong::Cgroup cgroup;
+        if (0 != cgroup.Attach(pid)) {
+            return -1;
+        }
+        return cgroup.Update(json);
+    } catch (const std::exception &e) {
+        logErr() << "failed: " << e.what();
+        return -1;
+    }
+}
+
+// ll-box trace dump [ring file], the latest ring by default
+static int trace(int argc, char **argv)
+{
+    if (argc < 3 || std::string(argv[2]) != "dump") {
+        logErr() << "usage: ll-box trace dump [ring file]";
+        return -1;
+    }
+
+    // the path is the caller's, read it with the permission of the user
+    if (0 != setgid(getgid()) || 0 != setuid(getuid())) {
+        logErr() << "drop privilege failed" << linglong::util::errnoString();
+        return -1;
+    }
+
+    auto path = argc > 3 ? std::string(argv[3]) : linglong::util::trace::LatestRing();
+    if (path.empty()) {
+        logErr() << "no trace ring found";
+        return -1;
+    }
+    return linglong::util::trace::DumpRing(path, std::cout);
+}
+
 int main(int argc, char **argv)
 {
     // TODO(iceyer): move loader to ll-loader?
@@ -30,6 +143,27 @@ int main(int argc, char **argv)
         option.rootless = true;
     }
 
+    auto traceDir = getenv("LINGLONG_BOX_TRACE");
+    if (traceDir) {
+        linglong::util::trace::Open(traceDir);
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--serve") {
+        return serve(argc, argv, option);
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "exec") {
+        return exec(argc, argv);
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "update") {
+        return update(argc, argv);
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "trace") {
+        return trace(argc, argv);
+    }
+
     try {
         linglong::Runtime runtime;
         nlohmann::json json;
@@ -46,9 +180,17 @@ int main(int argc, char **argv)
 
             reader.reset(new linglong::util::MessageReader(socket));
 
-            json = reader->read();
+            auto content = reader->readRaw();
 
-            runtime = json.get<linglong::Runtime>();
+            // the json DOM is only built on cache miss
+            linglong::util::RuntimeCache cache(linglong::util::RuntimeCache::DefaultDir());
+            if (!cache.Load(content, runtime)) {
+                json = nlohmann::json::parse(content);
+                runtime = json.get<linglong::Runtime>();
+                cache.Store(content, runtime);
+            } else if (linglong::util::fs::exists("/tmp/ll-debug")) {
+                json = nlohmann::json::parse(content);
+            }
         }
 
         if (linglong::util::fs::exists("/tmp/ll-debug")) {
@@ -6,9 +6,71 @@
 
 #include "common.h"
 
+#include <cstdio>
+
 namespace linglong {
 namespace util {
 
+namespace {
+
+// most paths, id maps and cgroup values are shorter
+const size_t kFormatStackSize = 256;
+
+} // namespace
+
+std::string &vformat_append(std::string &out, const char *fmt, va_list ap)
+{
+    char stack[kFormatStackSize];
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(stack, sizeof(stack), fmt, ap);
+    if (n < 0) {
+        va_end(again);
+        return out;
+    }
+
+    auto size = static_cast<size_t>(n);
+    if (size < sizeof(stack)) {
+        out.append(stack, size);
+    } else {
+        auto offset = out.size();
+        // the terminating null is written past the text and cut off
+        out.resize(offset + size + 1);
+        vsnprintf(&out[offset], size + 1, fmt, again);
+        out.resize(offset + size);
+    }
+    va_end(again);
+    return out;
+}
+
+std::string format(const char *fmt, ...)
+{
+    std::string out;
+    va_list ap;
+    va_start(ap, fmt);
+    vformat_append(out, fmt, ap);
+    va_end(ap);
+    return out;
+}
+
+std::string &format_append(std::string &out, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vformat_append(out, fmt, ap);
+    va_end(ap);
+    return out;
+}
+
+int format_to(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
 std::string str_vec_join(const str_vec &vec, char sep)
 {
     if (vec.empty()) {
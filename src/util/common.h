@@ -10,6 +10,7 @@
 #include <memory>
 #include <cstring>
 #include <cstdarg>
+#include <string>
 
 #include <vector>
 #include <iostream>
@@ -24,24 +25,19 @@ str_vec str_spilt(const std::string &s, const std::string &sep);
 
 std::string str_vec_join(const str_vec &vec, char sep);
 
-inline std::string format(const std::string fmt, ...)
-{
-    int n = ((int)fmt.size()) * 2;
-    std::unique_ptr<char[]> formatted;
-    va_list ap;
-    while (true) {
-        formatted.reset(new char[n]);
-        strcpy(&formatted[0], fmt.c_str());
-        va_start(ap, fmt);
-        int final_n = vsnprintf(&formatted[0], n, fmt.c_str(), ap);
-        va_end(ap);
-        if (final_n < 0 || final_n >= n)
-            n += abs(final_n - n + 1);
-        else
-            break;
-    }
-    return std::string {formatted.get()};
-}
+/*!
+ * printf into a std::string. Arguments are checked against fmt at compile time by -Wformat, so fmt is a literal. The
+ * text is formatted into a stack buffer, a longer one straight into the string, so there is one allocation at most.
+ */
+std::string format(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// append to out without a temporary string, such as the text of a log record
+std::string &format_append(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// printf into storage of the caller, return the length of the whole text as snprintf, it's truncated if size is short
+int format_to(char *buf, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+std::string &vformat_append(std::string &out, const char *fmt, va_list ap) __attribute__((format(printf, 2, 0)));
 
 } // namespace util
 } // namespace linglong
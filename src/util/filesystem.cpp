@@ -6,15 +6,143 @@
 
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <algorithm>
 #include <string>
+#include <ctime>
 #include <climits>
 #include <unistd.h>
 
 #include "filesystem.h"
 #include "logger.h"
 
+namespace {
+
+// copied from linux/mount.h and linux/openat2.h, these headers conflict with sys/mount.h on some glibc.
+const unsigned int kOpenTreeClone = 1;
+const unsigned int kAtRecursive = 0x8000;
+const unsigned int kMoveMountFEmptyPath = 0x00000004;
+const unsigned int kMoveMountTEmptyPath = 0x00000040;
+const unsigned int kFsopenCloexec = 0x00000001;
+const unsigned int kFsmountCloexec = 0x00000001;
+const unsigned int kFsconfigSetFlag = 0;
+const unsigned int kFsconfigSetString = 1;
+const unsigned int kFsconfigCmdCreate = 6;
+
+const uint64_t kMountAttrRdonly = 0x00000001;
+const uint64_t kMountAttrNosuid = 0x00000002;
+const uint64_t kMountAttrNodev = 0x00000004;
+const uint64_t kMountAttrNoexec = 0x00000008;
+const uint64_t kMountAttrAtime = 0x00000070;
+const uint64_t kMountAttrRelatime = 0x00000000;
+const uint64_t kMountAttrNoatime = 0x00000010;
+const uint64_t kMountAttrStrictatime = 0x00000020;
+const uint64_t kMountAttrNodiratime = 0x00000080;
+
+const uint64_t kResolveNoMagiclinks = 0x02;
+const uint64_t kResolveBeneath = 0x08;
+
+struct MountAttr {
+    uint64_t attr_set;
+    uint64_t attr_clr;
+    uint64_t propagation;
+    uint64_t userns_fd;
+};
+
+struct OpenHow {
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+
+#ifndef SYS_open_tree
+#define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount 429
+#endif
+#ifndef SYS_fsopen
+#define SYS_fsopen 430
+#endif
+#ifndef SYS_fsconfig
+#define SYS_fsconfig 431
+#endif
+#ifndef SYS_fsmount
+#define SYS_fsmount 432
+#endif
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr 442
+#endif
+
+// convert MS_* flags which are per mount to MOUNT_ATTR_*. atime is only changed when the flags ask for it.
+MountAttr toMountAttr(unsigned long int flags)
+{
+    MountAttr attr = {};
+    if (flags & MS_RDONLY) {
+        attr.attr_set |= kMountAttrRdonly;
+    }
+    if (flags & MS_NOSUID) {
+        attr.attr_set |= kMountAttrNosuid;
+    }
+    if (flags & MS_NODEV) {
+        attr.attr_set |= kMountAttrNodev;
+    }
+    if (flags & MS_NOEXEC) {
+        attr.attr_set |= kMountAttrNoexec;
+    }
+    if (flags & MS_NODIRATIME) {
+        attr.attr_set |= kMountAttrNodiratime;
+    }
+    if (flags & (MS_NOATIME | MS_STRICTATIME | MS_RELATIME)) {
+        attr.attr_clr |= kMountAttrAtime;
+        if (flags & MS_NOATIME) {
+            attr.attr_set |= kMountAttrNoatime;
+        } else if (flags & MS_STRICTATIME) {
+            attr.attr_set |= kMountAttrStrictatime;
+        } else {
+            attr.attr_set |= kMountAttrRelatime;
+        }
+    }
+    return attr;
+}
+
+// open target under root_fd, fail with EXDEV if it escapes
+int openTarget(int root_fd, const char *target)
+{
+    OpenHow how = {};
+    how.flags = O_PATH | O_CLOEXEC;
+    how.resolve = kResolveBeneath | kResolveNoMagiclinks;
+    return static_cast<int>(syscall(SYS_openat2, root_fd, target, &how, sizeof(how)));
+}
+
+// attach the detached mount to target and close it
+int attach(int mount_fd, int root_fd, const char *target)
+{
+    int target_fd = openTarget(root_fd, target);
+    if (target_fd < 0) {
+        auto olderrno = errno;
+        close(mount_fd);
+        errno = olderrno;
+        return -1;
+    }
+
+    auto ret = syscall(SYS_move_mount, mount_fd, "", target_fd, "", kMoveMountFEmptyPath | kMoveMountTEmptyPath);
+    auto olderrno = errno;
+    close(target_fd);
+    close(mount_fd);
+    errno = olderrno;
+    return ret == 0 ? 0 : -1;
+}
+
+} // namespace
+
 namespace linglong {
 namespace util {
 namespace fs {
@@ -222,6 +350,155 @@ int do_mount_with_fd(const char *root, const char *__special_file, const char *_
     return ret;
 }
 
+static int64_t monotonic_ms()
+{
+    struct timespec ts {
+    };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+int wait_until_exist(const path &p, int fd, int timeout_ms)
+{
+    auto target = p.string();
+    auto deadline = monotonic_ms() + timeout_ms;
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, p.parent_path().string().c_str(), IN_CREATE | IN_MOVED_TO) < 0) {
+        // parent not exist, check it with timeout
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+
+    int ret = -1;
+    for (;;) {
+        // check after the watch is added, or a creation between the check and the watch is missed
+        if (access(target.c_str(), F_OK) == 0) {
+            ret = 0;
+            break;
+        }
+
+        auto remain = deadline - monotonic_ms();
+        if (remain <= 0) {
+            break;
+        }
+
+        struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {fd, POLLIN, 0}};
+        auto timeout = static_cast<int>(inotify_fd < 0 ? std::min<int64_t>(remain, 10) : remain);
+        auto count = poll(fds, 2, timeout);
+        if (count < 0 && errno != EINTR) {
+            logErr() << "poll failed" << errnoString();
+            break;
+        }
+
+        if (fd >= 0 && fds[1].revents) {
+            ret = 1;
+            break;
+        }
+
+        if (inotify_fd >= 0 && (fds[0].revents & POLLIN)) {
+            // drain events, the path is checked again on the top
+            char buf[4096];
+            while (read(inotify_fd, buf, sizeof(buf)) > 0) {
+            }
+        }
+    }
+
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    return ret;
+}
+
+bool new_mount_api_available()
+{
+    static int available = -1;
+    if (available < 0) {
+        auto env = getenv("LL_BOX_MOUNT_API");
+        if (env && string(env) == "legacy") {
+            available = 0;
+        } else {
+            // an invalid call, it fails with EBADF or EINVAL when mount_setattr exists. A seccomp filter of a container
+            // runtime which does not know the syscalls fails them with EPERM.
+            int ret = static_cast<int>(syscall(SYS_mount_setattr, -1, "", 0, nullptr, 0));
+            available = (ret == 0 || (errno != ENOSYS && errno != EPERM)) ? 1 : 0;
+        }
+        logDbg() << "new mount api available:" << available;
+    }
+    return available == 1;
+}
+
+int do_bind_with_tree(int root_fd, const char *source, const char *target, unsigned long int flags)
+{
+    unsigned int recursive = (flags & MS_REC) ? kAtRecursive : 0;
+
+    int tree_fd = static_cast<int>(syscall(SYS_open_tree, AT_FDCWD, source, kOpenTreeClone | O_CLOEXEC | recursive));
+    if (tree_fd < 0) {
+        return -1;
+    }
+
+    // one mount_setattr does what the remount of a bind mount does, recursively for rbind.
+    auto attr = toMountAttr(flags);
+    if (attr.attr_set || attr.attr_clr) {
+        if (0 != syscall(SYS_mount_setattr, tree_fd, "", AT_EMPTY_PATH | recursive, &attr, sizeof(attr))) {
+            auto olderrno = errno;
+            close(tree_fd);
+            errno = olderrno;
+            return -1;
+        }
+    }
+
+    return attach(tree_fd, root_fd, target);
+}
+
+int do_mount_with_fsopen(int root_fd, const char *fstype, const char *source, const char *target,
+                         unsigned long int flags, const str_vec &data)
+{
+    int fs_fd = static_cast<int>(syscall(SYS_fsopen, fstype, kFsopenCloexec));
+    if (fs_fd < 0) {
+        return -1;
+    }
+
+    auto fail = [fs_fd]() -> int {
+        auto olderrno = errno;
+        close(fs_fd);
+        errno = olderrno;
+        return -1;
+    };
+
+    if (source && 0 != syscall(SYS_fsconfig, fs_fd, kFsconfigSetString, "source", source, 0)) {
+        return fail();
+    }
+
+    for (auto const &option : data) {
+        auto pos = option.find('=');
+        long ret;
+        if (pos == string::npos) {
+            ret = syscall(SYS_fsconfig, fs_fd, kFsconfigSetFlag, option.c_str(), nullptr, 0);
+        } else {
+            auto key = option.substr(0, pos);
+            auto value = option.substr(pos + 1);
+            ret = syscall(SYS_fsconfig, fs_fd, kFsconfigSetString, key.c_str(), value.c_str(), 0);
+        }
+        if (0 != ret) {
+            return fail();
+        }
+    }
+
+    if (0 != syscall(SYS_fsconfig, fs_fd, kFsconfigCmdCreate, nullptr, nullptr, 0)) {
+        return fail();
+    }
+
+    auto attr = toMountAttr(flags);
+    int mount_fd = static_cast<int>(syscall(SYS_fsmount, fs_fd, kFsmountCloexec, attr.attr_set));
+    if (mount_fd < 0) {
+        return fail();
+    }
+    close(fs_fd);
+
+    return attach(mount_fd, root_fd, target);
+}
+
 } // namespace fs
 } // namespace util
 } // namespace linglong
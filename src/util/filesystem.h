@@ -22,6 +22,12 @@ namespace fs {
 
 bool exists(const std::string &s);
 
+class path;
+
+// block until p exists (return 0), fd is readable (return 1) or timeout (return -1), fd is ignored if less than 0.
+// the parent directory of p is watched with inotify, so it returns as soon as p is created.
+int wait_until_exist(const path &p, int fd, int timeout_ms);
+
 class path : public std::basic_string<char>
 {
 public:
@@ -64,20 +70,7 @@ public:
 
     // call to this function will block until `path` exists (rerturn 0) or timeout (return -1)
     // default timeout is 1 second
-    int wait_until_exsit(int utimeout = 1000)
-    {
-        int time = 0;
-        while (true) {
-            if (access(this->string().c_str(), F_OK) == 0) {
-                return 0;
-            } else if (++time > utimeout) {
-                return -1;
-            } else {
-                usleep(10);
-            }
-        }
-        return 0;
-    }
+    int wait_until_exsit(int timeout_ms = 1000) const { return wait_until_exist(*this, -1, timeout_ms) == 0 ? 0 : -1; }
 
     void touch()
     {
@@ -175,6 +168,18 @@ path read_symlink(const path &p);
 int do_mount_with_fd(const char *root, const char *__special_file, const char *__dir, const char *__fstype,
                      unsigned long int __rwflag, const void *__data) __THROW;
 
+// The new mount api (open_tree/move_mount/fsopen/fsmount/mount_setattr) is used when mount_setattr exists, which is
+// since linux 5.12 and not denied with EPERM. Set LL_BOX_MOUNT_API=legacy to disable it.
+bool new_mount_api_available();
+
+// Same as do_mount_with_fd, but mount with the new mount api. The target is a path relative to root_fd and is opened
+// with RESOLVE_BENEATH, so it's never out of container rootfs and no procfs lookup is needed.
+// Return -1 and keep errno if any step fail, nothing is mounted in that case.
+int do_bind_with_tree(int root_fd, const char *source, const char *target, unsigned long int flags);
+
+int do_mount_with_fsopen(int root_fd, const char *fstype, const char *source, const char *target,
+                         unsigned long int flags, const str_vec &data);
+
 } // namespace fs
 } // namespace util
 } // namespace linglong
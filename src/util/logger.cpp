@@ -5,11 +5,140 @@
  */
 
 #include "logger.h"
+
 #include <sys/syslog.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
 
 namespace linglong {
 namespace util {
 
+namespace {
+
+const size_t kRingSize = 256;
+// a longer record is written to sinks directly
+const size_t kRecordSize = 512;
+
+struct Record {
+    // seq + 1 once the record is written
+    std::atomic<uint64_t> ready;
+    int level;
+    uint32_t size;
+    char text[kRecordSize];
+};
+
+// records of one process, writers reserve a seq with head and the flusher advances tail
+struct Ring {
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<bool> flushing;
+    // records left by the parent in a forked child are dropped, the parent flushes them
+    std::atomic<pid_t> owner;
+    Record records[kRingSize];
+};
+
+Ring ring;
+
+enum Sink {
+    kSyslog = 1 << 0,
+    kStdout = 1 << 1,
+    kStderr = 1 << 2,
+    kFile = 1 << 3,
+};
+
+int sinks = kSyslog;
+int logFileFd = -1;
+
+const char *const kPrefixes[] = {"[DBG |", "[IFO |", "[WAN |", "[ERR |", "[FAL |"};
+const char *const kColors[] = {"", "\033[1;96m", "\033[1;93m", "\033[1;31m", "\033[1;91m"};
+const int kSyslogLevels[] = {LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR, LOG_ERR};
+
+// "<pidns inode>:<pid>" of the calling thread, read once per pid
+thread_local pid_t pidnsOwner = 0;
+thread_local char pidnsText[48];
+
+void WriteAll(int fd, const std::string &content)
+{
+    size_t offset = 0;
+    while (offset < content.size()) {
+        auto n = write(fd, content.data() + offset, content.size() - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        offset += static_cast<size_t>(n);
+    }
+}
+
+void Append(int level, const char *text, size_t size, std::string &console, std::string &plain)
+{
+    if (sinks & kSyslog) {
+        syslog(kSyslogLevels[level], "%.*s", static_cast<int>(size), text);
+    }
+    if (sinks & (kStdout | kStderr)) {
+        console.append(kColors[level]).append(kPrefixes[level]).append(" ").append(text, size);
+        console.append(level == Logger::Debug ? "\n" : "\033[0m\n");
+    }
+    if (sinks & kFile) {
+        plain.append(kPrefixes[level]).append(" ").append(text, size).append("\n");
+    }
+}
+
+void WriteSinks(const std::string &console, const std::string &plain)
+{
+    if (!console.empty()) {
+        if (sinks & kStdout) {
+            WriteAll(STDOUT_FILENO, console);
+        }
+        if (sinks & kStderr) {
+            WriteAll(STDERR_FILENO, console);
+        }
+    }
+    if (!plain.empty()) {
+        WriteAll(logFileFd, plain);
+    }
+}
+
+void Push(Logger::Level level, const std::string &text, pid_t pid)
+{
+    auto owner = ring.owner.load(std::memory_order_acquire);
+    if (owner != pid && ring.owner.compare_exchange_strong(owner, pid)) {
+        ring.tail.store(ring.head.load());
+        // forked while another thread was flushing
+        ring.flushing.store(false);
+    }
+
+    if (text.size() > kRecordSize) {
+        Logger::Flush();
+        std::string console, plain;
+        Append(level, text.c_str(), text.size(), console, plain);
+        WriteSinks(console, plain);
+        return;
+    }
+
+    auto seq = ring.head.fetch_add(1);
+    while (seq - ring.tail.load(std::memory_order_acquire) >= kRingSize) {
+        Logger::Flush();
+        sched_yield();
+    }
+
+    auto &record = ring.records[seq % kRingSize];
+    record.level = level;
+    record.size = static_cast<uint32_t>(text.size());
+    memcpy(record.text, text.c_str(), text.size());
+    record.ready.store(seq + 1, std::memory_order_release);
+}
+
+} // namespace
+
 std::string errnoString()
 {
     return util::format("errno(%d): %s", errno, strerror(errno));
@@ -22,13 +151,124 @@ std::string RetErrString(int ret)
 
 std::string GetPidnsPid()
 {
-    char buf[30];
-    memset(buf, 0, sizeof(buf));
-    if (readlink("/proc/self/ns/pid", buf, sizeof(buf) - 1) == -1) {
-        return "";
-    };
-    std::string str = buf;
-    return str.substr(5, str.length() - 6) + ":" + std::to_string(getpid()); // 6 = strlen("pid:[]")
+    auto pid = getpid();
+    if (pidnsOwner != pid) {
+        char buf[30];
+        memset(buf, 0, sizeof(buf));
+        pidnsText[0] = '\0';
+        pidnsOwner = pid;
+        if (readlink("/proc/self/ns/pid", buf, sizeof(buf) - 1) == -1) {
+            return "";
+        };
+        std::string str = buf;
+        str = str.substr(5, str.length() - 6) + ":" + std::to_string(pid); // 6 = strlen("pid:[]")
+        snprintf(pidnsText, sizeof(pidnsText), "%s", str.c_str());
+    }
+    return pidnsText;
+}
+
+Logger::~Logger()
+{
+    // built without the log macros
+    if (!Enabled(level)) {
+        return;
+    }
+
+    auto record = GetPidnsPid();
+    format_append(record, " | %s:%d ] ", function, line).append(text);
+    Push(level, record, pidnsOwner);
+
+    if (level >= Error) {
+        Flush();
+    }
+    if (level == Fatal) {
+        exit(-1);
+    }
+}
+
+Logger &Logger::operator<<(const char *x)
+{
+    text.append(x ? x : "(null)").append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(const std::string &x)
+{
+    text.append(x).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(char x)
+{
+    text.append(1, x).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(int x)
+{
+    text.append(std::to_string(x)).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(unsigned int x)
+{
+    text.append(std::to_string(x)).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(long x)
+{
+    text.append(std::to_string(x)).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(unsigned long x)
+{
+    text.append(std::to_string(x)).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(long long x)
+{
+    text.append(std::to_string(x)).append(" ");
+    return *this;
+}
+
+Logger &Logger::operator<<(unsigned long long x)
+{
+    text.append(std::to_string(x)).append(" ");
+    return *this;
+}
+
+void Logger::Flush()
+{
+    // the other flusher writes our records too
+    if (ring.flushing.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+
+    std::string console, plain;
+    auto head = ring.head.load();
+    for (auto tail = ring.tail.load(); tail < head; ++tail) {
+        auto &record = ring.records[tail % kRingSize];
+        // still being written, it's left to the next flush
+        if (record.ready.load(std::memory_order_acquire) != tail + 1) {
+            break;
+        }
+        Append(record.level, record.text, record.size, console, plain);
+        ring.tail.store(tail + 1, std::memory_order_release);
+    }
+    WriteSinks(console, plain);
+
+    ring.flushing.store(false, std::memory_order_release);
+}
+
+void Logger::Reset()
+{
+    pidnsOwner = 0;
+    ring.owner.store(getpid());
+    ring.tail.store(ring.head.load());
+    ring.flushing.store(false);
 }
 
 static Logger::Level getLogLevelFromStr(std::string str)
@@ -48,11 +288,48 @@ static Logger::Level getLogLevelFromStr(std::string str)
     }
 }
 
+static void initSinks(bool console)
+{
+    auto env = getenv("LINGLONG_LOG_SINK");
+    if (!env) {
+        sinks = kSyslog | (console ? kStdout : 0);
+        return;
+    }
+
+    sinks = 0;
+    for (auto const &sink : str_spilt(env, ",")) {
+        if (sink == "syslog") {
+            sinks |= kSyslog;
+        } else if (sink == "stdout") {
+            sinks |= kStdout;
+        } else if (sink == "stderr") {
+            sinks |= kStderr;
+        } else if (sink.compare(0, 5, "file:") == 0) {
+            // as the user, the caller of a setuid ll-box must not make root create or append to any file
+            auto euid = geteuid();
+            if (euid != getuid()) {
+                seteuid(getuid());
+            }
+            logFileFd = open(sink.c_str() + 5, O_WRONLY | O_CREAT | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0644);
+            if (euid != geteuid()) {
+                seteuid(euid);
+            }
+            sinks |= logFileFd >= 0 ? kFile : kStderr;
+        }
+    }
+}
+
 static Logger::Level initLogLevel()
 {
     openlog("ll-box", LOG_PID, LOG_USER);
     auto env = getenv("LINGLONG_LOG_LEVEL");
-    return getLogLevelFromStr(env ? env : "");
+    initSinks(env != nullptr);
+
+    atexit(Logger::Flush);
+    // a forked child drops records of its parent, so flush them before fork
+    pthread_atfork(Logger::Flush, nullptr, nullptr);
+
+    return env ? getLogLevelFromStr(env) : Logger::Warring;
 }
 
 Logger::Level Logger::LOGLEVEL = initLogLevel();
@@ -10,12 +10,12 @@
 #include "util.h"
 
 #include <unistd.h>
-#include <sys/syslog.h>
 
 #include <iostream>
 #include <sstream>
 #include <algorithm>
 #include <cstring>
+#include <string>
 #include <utility>
 
 namespace linglong {
@@ -24,6 +24,16 @@ std::string errnoString();
 std::string RetErrString(int);
 std::string GetPidnsPid();
 
+/*!
+ * Logger formats a record and hands it to a ring buffer of the process, the ring is written to the sinks selected by
+ * LINGLONG_LOG_SINK, a comma separated list of "syslog", "stdout", "stderr" and "file:<path>". By default records go to
+ * syslog, and to stdout if LINGLONG_LOG_LEVEL is set. LINGLONG_LOG_LEVEL is the lowest level logged, Warning if unset.
+ * The file is opened with the real uid and not through a symlink, stderr is used if that fails.
+ *
+ * The log macros check the level before a Logger is built, so a disabled record costs a compare. There is no writer
+ * thread, ll-box forks and enters namespaces which needs to be single threaded. Records are flushed at Error and
+ * Fatal, when the ring is full, before the process blocks in a wait loop, clones, forks or execs, and at exit.
+ */
 class Logger
 {
 public:
@@ -40,81 +50,62 @@ public:
         , function(fn)
         , line(line) {};
 
-    ~Logger()
-    {
-        std::string prefix;
-        auto pid_ns = GetPidnsPid();
-        int syslogLevel = LOG_DEBUG;
-        switch (level) {
-        case Debug:
-            syslogLevel = LOG_DEBUG;
-        case Info:
-            syslogLevel = LOG_INFO;
-        case Warring:
-            syslogLevel = LOG_WARNING;
-        case Error:
-            syslogLevel = LOG_ERR;
-        case Fatal:
-            syslogLevel = LOG_ERR;
-        }
-        syslog(syslogLevel, "%s|%s:%d %s", pid_ns.c_str(), function, line, ss.str().c_str());
-        if (level < LOGLEVEL) {
-            return;
-        }
-        switch (level) {
-        case Debug:
-            prefix = "[DBG |";
-            std::cout << prefix << " " << pid_ns << " | " << function << ":" << line << " ] " << ss.str() << std::endl;
-            break;
-        case Info:
-            prefix = "[IFO |";
-            std::cout << "\033[1;96m";
-            std::cout << prefix << " " << pid_ns << " | " << function << ":" << line << " ] " << ss.str();
-            std::cout << "\033[0m" << std::endl;
-            break;
-        case Warring:
-            prefix = "[WAN |";
-            std::cout << "\033[1;93m";
-            std::cout << prefix << " " << pid_ns << " | " << function << ":" << line << " ] " << ss.str();
-            std::cout << "\033[0m" << std::endl;
-            break;
-        case Error:
-            prefix = "[ERR |";
-            std::cout << "\033[1;31m";
-            std::cout << prefix << " " << pid_ns << " | " << function << ":" << line << " ] " << ss.str();
-            std::cout << "\033[0m" << std::endl;
-            break;
-        case Fatal:
-            prefix = "[FAL |";
-            std::cout << "\033[1;91m";
-            std::cout << prefix << " " << pid_ns << " | " << function << ":" << line << " ] " << ss.str();
-            std::cout << "\033[0m" << std::endl;
-            exit(-1);
-            break;
-        }
-    }
+    ~Logger();
 
     template<class T>
     Logger &operator<<(const T &x)
     {
-        ss << x << " ";
+        std::ostringstream ss;
+        ss << x;
+        text += ss.str();
+        text += ' ';
         return *this;
     }
 
+    Logger &operator<<(const char *x);
+    Logger &operator<<(const std::string &x);
+    Logger &operator<<(char x);
+    Logger &operator<<(int x);
+    Logger &operator<<(unsigned int x);
+    Logger &operator<<(long x);
+    Logger &operator<<(unsigned long x);
+    Logger &operator<<(long long x);
+    Logger &operator<<(unsigned long long x);
+
+    // Fatal is always enabled, it exits
+    static bool Enabled(Level l) { return l >= LOGLEVEL || l == Fatal; }
+
+    // write records in the ring to sinks
+    static void Flush();
+    // drop records and cached pid namespace of the parent, call it first in a child which may share its pid with the
+    // parent, such as pid 1 cloning a new pid namespace
+    static void Reset();
+
 private:
     static Level LOGLEVEL;
     Level level = Debug;
     const char *function;
     int line;
-    std::ostringstream ss;
+    std::string text;
+};
+
+// turn a Logger expression into void, so that the log macros can skip it with ?:
+struct LogVoidify {
+    void operator&(const Logger &) { }
 };
+
 } // namespace util
 } // namespace linglong
 
-#define logDbg() (linglong::util::Logger(linglong::util::Logger::Debug, __FUNCTION__, __LINE__))
-#define logWan() (linglong::util::Logger(linglong::util::Logger::Warring, __FUNCTION__, __LINE__))
-#define logInf() (linglong::util::Logger(linglong::util::Logger::Info, __FUNCTION__, __LINE__))
-#define logErr() (linglong::util::Logger(linglong::util::Logger::Error, __FUNCTION__, __LINE__))
-#define logFal() (linglong::util::Logger(linglong::util::Logger::Fatal, __FUNCTION__, __LINE__))
+#define LINGLONG_LOG(level)                                                                                            \
+    !linglong::util::Logger::Enabled(level)                                                                            \
+        ? (void)0                                                                                                      \
+        : linglong::util::LogVoidify() & linglong::util::Logger(level, __FUNCTION__, __LINE__)
+
+#define logDbg() LINGLONG_LOG(linglong::util::Logger::Debug)
+#define logWan() LINGLONG_LOG(linglong::util::Logger::Warring)
+#define logInf() LINGLONG_LOG(linglong::util::Logger::Info)
+#define logErr() LINGLONG_LOG(linglong::util::Logger::Error)
+#define logFal() LINGLONG_LOG(linglong::util::Logger::Fatal)
 
 #endif /* LINGLONG_BOX_SRC_UTIL_LOGGER_H_ */
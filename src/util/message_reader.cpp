@@ -25,8 +25,24 @@ MessageReader::~MessageReader()
 
 nlohmann::json MessageReader::read()
 {
+    auto message = readRaw();
+    if (message.empty()) {
+        return nlohmann::json();
+    }
+    return nlohmann::json::parse(message);
+}
+
+std::string MessageReader::readRaw()
+{
+    // a read may have brought more than one message
+    auto end = source.find('\0');
+    if (end != std::string::npos) {
+        auto message = source.substr(0, end);
+        source.erase(0, end + 1);
+        return message;
+    }
+
     std::unique_ptr<char[]> buf(new char[step + 1]);
-    static std::string source = "";
     int ret;
     while ((ret = ::read(fd, buf.get(), step))) {
         if (ret == -1) {
@@ -40,31 +56,44 @@ nlohmann::json MessageReader::read()
                 source.push_back(*it);
             }
             if (it != buf.get() + ret && *it == '\0') {
-                auto json = nlohmann::json::parse(source);
+                auto message = std::move(source);
                 source = std::string(it + 1, buf.get() + ret);
-                return json;
+                return message;
             }
         }
     }
 
-    if (!source.empty()) {
-        auto json = nlohmann::json::parse(source);
-        source = "";
-        return json;
-    }
+    auto message = std::move(source);
+    source = "";
+    return message;
+}
+
+bool MessageReader::pending() const
+{
+    return source.find('\0') != std::string::npos;
+}
 
-    return nlohmann::json();
+int MessageReader::fill()
+{
+    std::unique_ptr<char[]> buf(new char[step]);
+    int ret = ::read(fd, buf.get(), step);
+    if (ret > 0) {
+        source.append(buf.get(), ret);
+    }
+    return ret;
 }
 
 void MessageReader::writeChildExit(int pid, std::string cmd, int wstatus, std::string info)
 {
-    std::string msgTemplate = R"({"type":"childExit","pid":%d,"arg0":"%s","wstatus":%d,"information":"%s"})";
-    auto source = util::format(msgTemplate, pid, cmd.c_str(), wstatus, info.c_str());
+    auto source = util::format(R"({"type":"childExit","pid":%d,"arg0":"%s","wstatus":%d,"information":"%s"})", pid,
+                               cmd.c_str(), wstatus, info.c_str());
     write(source);
 }
 
 void MessageReader::write(std::string msg)
 {
+    // messages are separated by '\0' in both directions
+    msg.push_back('\0');
     auto pos = msg.c_str();
     do {
         int ret = ::write(fd, pos, msg.c_str() + msg.length() - pos);
@@ -12,19 +12,30 @@
 namespace linglong {
 namespace util {
 
-// MessageReader read jsons separated by '\0' from fd.
+// MessageReader read jsons separated by '\0' from fd, messages written to fd are terminated by '\0' the same way,
+// including childExit, which was written without it before stats and pressure messages were added.
 class MessageReader
 {
 public:
     MessageReader(int fd, unsigned int step = 1024);
     ~MessageReader();
     nlohmann::json read();
+    // read the next message without parsing it, empty if there is none
+    std::string readRaw();
+    // whether a whole message is buffered, it's read without waiting for fd. Drain it after a poll reported fd, the
+    // poll will not report the buffered data again.
+    bool pending() const;
+    // one read of what fd has into the buffer, for a non-blocking fd in an event loop. Return the bytes read, 0 on EOF
+    // or -1 with errno set, EAGAIN if there was nothing.
+    int fill();
     void write(std::string msg);
     void writeChildExit(int pid, std::string cmd, int wstatus, std::string info);
     int fd;
 
 private:
     int step;
+    // data read after the last '\0'
+    std::string source;
 };
 } // namespace util
 } // namespace linglong
@@ -0,0 +1,423 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "metrics.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "filesystem.h"
+#include "logger.h"
+
+namespace linglong {
+namespace util {
+namespace metrics {
+
+namespace {
+
+// upper bounds of histogram buckets in seconds, the last bucket is +Inf
+const double kBuckets[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+const size_t kBucketCount = sizeof(kBuckets) / sizeof(kBuckets[0]);
+
+// how often the watcher looks for changed counters
+const std::chrono::milliseconds kWatchInterval(1000);
+
+struct Histogram {
+    // not cumulative, summed up when written
+    std::atomic<uint64_t> buckets[kBucketCount + 1];
+    std::atomic<uint64_t> sumNs;
+};
+
+struct State {
+    // CLOCK_MONOTONIC at Open
+    uint64_t start;
+    // bumped on every update, the file of the instance is rewritten when it moves
+    std::atomic<uint64_t> version;
+    std::atomic<uint64_t> counters[kCounterCount];
+    std::atomic<uint64_t> failures[kPhaseCount];
+    Histogram durations[kDurationCount];
+};
+
+State *state = nullptr;
+std::string metricsDir;
+
+// serializes writes of the watcher and the caller
+std::mutex writeMutex;
+uint64_t writtenVersion = 0;
+
+std::thread watcher;
+std::mutex watchMutex;
+std::condition_variable watchCond;
+bool watchStop = false;
+
+struct Family {
+    const char *name;
+    const char *type;
+    const char *help;
+};
+
+const Family kCounterFamilies[] = {
+    {"ll_box_launches_total", "counter", "Launches of ll-box."},
+    {"ll_box_mounts_total", "counter", "Mount steps done."},
+    {"ll_box_mount_failures_total", "counter", "Mount steps failed."},
+    {"ll_box_mount_fallbacks_total", "counter", "Sysfs and mqueue mounts done by the bind retry."},
+    {"ll_box_children_total", "counter", "Processes started by init."},
+    {"ll_box_children_exited_total", "counter", "Processes reaped by init."},
+};
+static_assert(sizeof(kCounterFamilies) / sizeof(kCounterFamilies[0]) == kCounterCount, "a Counter has no family");
+
+const Family kFailureFamily = {"ll_box_launch_failures_total", "counter", "Launches failed, by phase."};
+const char *const kPhaseNames[] = {"clone-entry", "mount", "pivot-root", "clone-init", "seccomp", "exec"};
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) == kPhaseCount, "a Phase has no name");
+
+const Family kDurationFamilies[] = {
+    {"ll_box_time_to_exec_seconds", "histogram", "Time from the start of ll-box to the first exec."},
+    {"ll_box_mount_seconds", "histogram", "Time to mount the container path."},
+};
+static_assert(sizeof(kDurationFamilies) / sizeof(kDurationFamilies[0]) == kDurationCount, "a Duration has no family");
+
+const Family kRunningFamily = {"ll_box_children", "gauge", "Processes supervised by init."};
+
+struct Sample {
+    const Family *family;
+    // name and labels
+    std::string series;
+    double value;
+    // a sum of seconds, others are counts
+    bool seconds;
+};
+
+uint64_t Now()
+{
+    struct timespec ts {
+    };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// "name{labels}", label is "key=\"value\"" or empty
+std::string Series(const char *name, const std::string &label, const std::string &extra = "")
+{
+    std::string labels = label;
+    if (!extra.empty()) {
+        labels += (labels.empty() ? "" : ",") + extra;
+    }
+    return labels.empty() ? std::string(name) : format("%s{%s}", name, labels.c_str());
+}
+
+// samples of the counters, gauges are left out of the rollup
+std::vector<Sample> Samples(const std::string &label, bool gauges)
+{
+    std::vector<Sample> samples;
+    for (uint32_t i = 0; i < kCounterCount; ++i) {
+        auto family = &kCounterFamilies[i];
+        samples.push_back({family, Series(family->name, label), double(state->counters[i].load()), false});
+    }
+
+    for (uint32_t i = 0; i < kPhaseCount; ++i) {
+        samples.push_back({&kFailureFamily,
+                           Series(kFailureFamily.name, label, format("phase=\"%s\"", kPhaseNames[i])),
+                           double(state->failures[i].load()), false});
+    }
+
+    for (uint32_t i = 0; i < kDurationCount; ++i) {
+        auto family = &kDurationFamilies[i];
+        auto const &histogram = state->durations[i];
+        std::string name = family->name;
+        uint64_t count = 0;
+        for (size_t b = 0; b <= kBucketCount; ++b) {
+            count += histogram.buckets[b].load();
+            auto le = b < kBucketCount ? format("le=\"%g\"", kBuckets[b]) : std::string("le=\"+Inf\"");
+            samples.push_back({family, Series((name + "_bucket").c_str(), label, le), double(count), false});
+        }
+        samples.push_back(
+            {family, Series((name + "_sum").c_str(), label), histogram.sumNs.load() / 1e9, true});
+        samples.push_back({family, Series((name + "_count").c_str(), label), double(count), false});
+    }
+
+    if (gauges) {
+        auto started = state->counters[kChildren].load();
+        auto exited = state->counters[kChildrenExited].load();
+        samples.push_back(
+            {&kRunningFamily, Series(kRunningFamily.name, label), double(started - std::min(started, exited)), false});
+    }
+    return samples;
+}
+
+std::string Render(const std::vector<Sample> &samples)
+{
+    std::string text;
+    const Family *family = nullptr;
+    for (auto const &sample : samples) {
+        if (sample.family != family) {
+            family = sample.family;
+            text += format("# HELP %s %s\n# TYPE %s %s\n", family->name, family->help, family->name, family->type);
+        }
+        text += format(sample.seconds ? "%s %.6f\n" : "%s %.0f\n", sample.series.c_str(), sample.value);
+    }
+    return text;
+}
+
+// values by series of a file written by Render
+std::map<std::string, double> Parse(const std::string &text)
+{
+    std::map<std::string, double> values;
+    for (auto const &line : str_spilt(text, "\n")) {
+        auto space = line.rfind(' ');
+        if (line.empty() || line[0] == '#' || space == std::string::npos) {
+            continue;
+        }
+        values[line.substr(0, space)] = strtod(line.c_str() + space + 1, nullptr);
+    }
+    return values;
+}
+
+std::string ReadFile(const std::string &path)
+{
+    std::string content;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return content;
+    }
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            content.append(buf, static_cast<size_t>(n));
+        }
+    }
+    close(fd);
+    return content;
+}
+
+// replace path by rename, so that a scraper never reads a partial file. The temporary name is not *.prom, which
+// node_exporter skips.
+int WriteFile(const std::string &path, const std::string &content)
+{
+    auto tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        logDbg() << "open" << tmp << "failed" << errnoString();
+        return -1;
+    }
+    size_t offset = 0;
+    while (offset < content.size()) {
+        auto n = write(fd, content.data() + offset, content.size() - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        offset += static_cast<size_t>(n);
+    }
+    close(fd);
+    if (offset != content.size() || 0 != rename(tmp.c_str(), path.c_str())) {
+        logDbg() << "write" << path << "failed" << errnoString();
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// add the counters of this instance to the rollup of the user
+int Rollup()
+{
+    auto lockPath = metricsDir + "/ll-box.lock";
+    int lock = open(lockPath.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (lock < 0) {
+        logDbg() << "open" << lockPath << "failed" << errnoString();
+        return -1;
+    }
+    while (0 != flock(lock, LOCK_EX) && errno == EINTR) {
+    }
+
+    auto path = metricsDir + "/ll-box.prom";
+    auto total = Parse(ReadFile(path));
+    auto samples = Samples("", false);
+    for (auto &sample : samples) {
+        sample.value += total[sample.series];
+    }
+    int ret = WriteFile(path, Render(samples));
+
+    close(lock);
+    return ret;
+}
+
+} // namespace
+
+std::string MetricsDir()
+{
+    auto env = getenv("LL_BOX_METRICS");
+    if (env && std::string(env) == "0") {
+        return "";
+    }
+
+    // unset for a setuid ll-box, the environment of its caller could point root anywhere. Checking euid does not
+    // work, it's the real uid here.
+    auto xdg = secure_getenv("XDG_RUNTIME_DIR");
+    std::string runtimeDir = (xdg && xdg[0] == '/') ? xdg : format("/run/user/%d", getuid());
+
+    auto dir = runtimeDir + "/linglong/metrics";
+    if (!fs::create_directories(fs::path(dir), 0755)) {
+        logDbg() << "create metrics dir" << dir << "failed" << errnoString();
+        return "";
+    }
+    return dir;
+}
+
+int Open(const std::string &dir)
+{
+    if (state) {
+        return 0;
+    }
+
+    // as the user, so that Write still works after a setuid ll-box drops root
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+    metricsDir = dir.empty() ? MetricsDir() : dir;
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    if (metricsDir.empty()) {
+        return -1;
+    }
+
+    void *addr = mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        logDbg() << "map metrics failed" << errnoString();
+        return -1;
+    }
+    // the anonymous mapping is zeroed, which is the initial value of the atomics
+    state = static_cast<State *>(addr);
+    state->start = Now();
+    Add(kLaunches);
+    return 0;
+}
+
+void Add(Counter counter, uint64_t n)
+{
+    if (state) {
+        state->counters[counter].fetch_add(n, std::memory_order_relaxed);
+        state->version.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Fail(Phase phase)
+{
+    if (state) {
+        state->failures[phase].fetch_add(1, std::memory_order_relaxed);
+        state->version.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Observe(Duration duration, uint64_t ns)
+{
+    if (!state) {
+        return;
+    }
+    auto &histogram = state->durations[duration];
+    size_t b = 0;
+    while (b < kBucketCount && ns > kBuckets[b] * 1e9) {
+        ++b;
+    }
+    histogram.buckets[b].fetch_add(1, std::memory_order_relaxed);
+    histogram.sumNs.fetch_add(ns, std::memory_order_relaxed);
+    state->version.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Elapsed()
+{
+    return state ? Now() - state->start : 0;
+}
+
+int Write(bool done)
+{
+    if (!state) {
+        return 0;
+    }
+    if (done) {
+        Unwatch();
+    }
+    std::lock_guard<std::mutex> lock(writeMutex);
+
+    // files are the user's, as the dir
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+
+    int ret = 0;
+    auto path = format("%s/ll-box-%d.prom", metricsDir.c_str(), getpid());
+    if (!done) {
+        // read before the samples, a change in between is written next time
+        writtenVersion = state->version.load();
+        ret = WriteFile(path, Render(Samples(format("pid=\"%d\"", getpid()), true)));
+    } else {
+        ret = Rollup();
+        unlink(path.c_str());
+        // counted once
+        munmap(state, sizeof(State));
+        state = nullptr;
+    }
+
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    return ret;
+}
+
+void Watch()
+{
+    if (!state || watcher.joinable()) {
+        return;
+    }
+
+    watchStop = false;
+    watcher = std::thread([] {
+        std::unique_lock<std::mutex> lock(watchMutex);
+        while (!watchCond.wait_for(lock, kWatchInterval, [] { return watchStop; })) {
+            if (state->version.load() != writtenVersion) {
+                Write();
+            }
+        }
+    });
+}
+
+void Unwatch()
+{
+    if (!watcher.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        watchStop = true;
+    }
+    watchCond.notify_one();
+    watcher.join();
+}
+
+} // namespace metrics
+} // namespace util
+} // namespace linglong
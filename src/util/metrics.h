@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_UTIL_METRICS_H_
+#define LINGLONG_BOX_SRC_UTIL_METRICS_H_
+
+#include <cstdint>
+#include <string>
+
+namespace linglong {
+namespace util {
+namespace metrics {
+
+/*!
+ * Launch counters for fleet dashboards, in the text format of Prometheus, so that the textfile collector of
+ * node_exporter can scrape them.
+ *
+ * Counters live in a shared anonymous mapping made before entry is cloned, so entry, init and the mount workers add to
+ * them with an atomic add and no syscall. ll-box, which stays on the host, writes them to
+ * $XDG_RUNTIME_DIR/linglong/metrics/ll-box-<pid>.prom when entry is cloned, then from a thread while it waits, about
+ * once a second if they changed. At exit the counters are also added to ll-box.prom of the same directory, the rollup
+ * of all launches of the user, under a flock, and the file of the instance is removed. Files are replaced by rename, a
+ * reader never sees a partial one. A setuid ll-box ignores $XDG_RUNTIME_DIR and writes the files with the uid of its
+ * caller.
+ *
+ * LL_BOX_METRICS=0 disables them.
+ */
+
+enum Counter : uint32_t {
+    kLaunches,
+    // steps mounted, failed, and mounted by the bind retry of sysfs and mqueue
+    kMounts,
+    kMountFailures,
+    kMountFallbacks,
+    // processes started and reaped by init
+    kChildren,
+    kChildrenExited,
+    kCounterCount,
+};
+
+// where a launch failed
+enum Phase : uint32_t {
+    kCloneEntry,
+    kMount,
+    kPivotRoot,
+    kCloneInit,
+    kSeccomp,
+    kExec,
+    kPhaseCount,
+};
+
+enum Duration : uint32_t {
+    // from the start of ll-box to the first process is executed
+    kTimeToExec,
+    // mounting the container path
+    kMountTime,
+    kDurationCount,
+};
+
+// map the counters and count a launch, in dir or the default dir if it's empty. Do nothing if they are mapped.
+int Open(const std::string &dir = "");
+
+// $XDG_RUNTIME_DIR/linglong/metrics, or /run/user/<uid>/linglong/metrics if it's unset or ll-box is setuid, created if
+// not exist. Return empty string if metrics are disabled by LL_BOX_METRICS=0.
+std::string MetricsDir();
+
+// the calls below do nothing if the counters are not mapped
+void Add(Counter counter, uint64_t n = 1);
+void Fail(Phase phase);
+// count a duration into the histogram
+void Observe(Duration duration, uint64_t ns);
+// nanoseconds since Open
+uint64_t Elapsed();
+
+// write the file of the instance, when done also stop the watcher, add the counters to the rollup and remove the file
+int Write(bool done = false);
+
+// rewrite the file of the instance from a thread when the counters change, such as init starting or reaping a child.
+// Start it after the last clone, the thread is not in a child.
+void Watch();
+void Unwatch();
+
+} // namespace metrics
+} // namespace util
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_UTIL_METRICS_H_ */
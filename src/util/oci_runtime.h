@@ -280,6 +280,8 @@ struct ResourceMemory {
     int64_t limit = -1;
     int64_t reservation = -1;
     int64_t swap = -1;
+    // not in oci, memory.high of cgroup v2
+    int64_t high = -1;
 };
 
 inline void from_json(const nlohmann::json &j, ResourceMemory &o)
@@ -287,6 +289,7 @@ inline void from_json(const nlohmann::json &j, ResourceMemory &o)
     o.limit = j.value("limit", -1);
     o.reservation = j.value("reservation", -1);
     o.swap = j.value("swap", -1);
+    o.high = j.value("high", -1);
 }
 
 inline void to_json(nlohmann::json &j, const ResourceMemory &o)
@@ -294,13 +297,15 @@ inline void to_json(nlohmann::json &j, const ResourceMemory &o)
     j["limit"] = o.limit;
     j["reservation"] = o.reservation;
     j["swap"] = o.swap;
+    j["high"] = o.high;
 }
 
 // https://github.com/containers/crun/blob/main/crun.1.md#cpu-controller
 // support v1 and v2 with conversion
 struct ResourceCPU {
     u_int64_t shares = 1024;
-    int64_t quota = 100000;
+    // no limit if not greater than 0
+    int64_t quota = -1;
     u_int64_t period = 100000;
     //    int64_t realtimeRuntime;
     //    int64_t realtimePeriod;
@@ -311,7 +316,7 @@ struct ResourceCPU {
 inline void from_json(const nlohmann::json &j, ResourceCPU &o)
 {
     o.shares = j.value("shares", 1024);
-    o.quota = j.value("quota", 100000);
+    o.quota = j.value("quota", -1);
     o.period = j.value("period", 100000);
 }
 
@@ -322,21 +327,138 @@ inline void to_json(nlohmann::json &j, const ResourceCPU &o)
     j["period"] = o.period;
 }
 
+// https://github.com/containers/crun/blob/main/crun.1.md#pids-controller
+struct ResourcePids {
+    int64_t limit = -1;
+};
+
+inline void from_json(const nlohmann::json &j, ResourcePids &o)
+{
+    o.limit = j.value("limit", -1);
+}
+
+inline void to_json(nlohmann::json &j, const ResourcePids &o)
+{
+    j["limit"] = o.limit;
+}
+
+struct BlockIOWeightDevice {
+    int64_t major = 0;
+    int64_t minor = 0;
+    uint16_t weight = 0;
+};
+
+inline void from_json(const nlohmann::json &j, BlockIOWeightDevice &o)
+{
+    o.major = j.at("major").get<int64_t>();
+    o.minor = j.at("minor").get<int64_t>();
+    o.weight = j.value("weight", 0);
+}
+
+inline void to_json(nlohmann::json &j, const BlockIOWeightDevice &o)
+{
+    j["major"] = o.major;
+    j["minor"] = o.minor;
+    j["weight"] = o.weight;
+}
+
+// rate 0 means no limit
+struct BlockIOThrottleDevice {
+    int64_t major = 0;
+    int64_t minor = 0;
+    uint64_t rate = 0;
+};
+
+inline void from_json(const nlohmann::json &j, BlockIOThrottleDevice &o)
+{
+    o.major = j.at("major").get<int64_t>();
+    o.minor = j.at("minor").get<int64_t>();
+    o.rate = j.value("rate", 0);
+}
+
+inline void to_json(nlohmann::json &j, const BlockIOThrottleDevice &o)
+{
+    j["major"] = o.major;
+    j["minor"] = o.minor;
+    j["rate"] = o.rate;
+}
+
+// not in oci, io.latency of cgroup v2, target is in microseconds and 0 means no target
+struct BlockIOLatencyDevice {
+    int64_t major = 0;
+    int64_t minor = 0;
+    uint64_t target = 0;
+};
+
+inline void from_json(const nlohmann::json &j, BlockIOLatencyDevice &o)
+{
+    o.major = j.at("major").get<int64_t>();
+    o.minor = j.at("minor").get<int64_t>();
+    o.target = j.value("target", 0);
+}
+
+inline void to_json(nlohmann::json &j, const BlockIOLatencyDevice &o)
+{
+    j["major"] = o.major;
+    j["minor"] = o.minor;
+    j["target"] = o.target;
+}
+
+// https://github.com/opencontainers/runtime-spec/blob/main/config-linux.md#block-io
+// weight is of cgroup v1 [10-1000], 0 means not set. leafWeight has no equivalent in cgroup v2 and is ignored.
+struct ResourceBlockIO {
+    uint16_t weight = 0;
+    std::vector<BlockIOWeightDevice> weightDevice;
+    std::vector<BlockIOThrottleDevice> throttleReadBpsDevice;
+    std::vector<BlockIOThrottleDevice> throttleWriteBpsDevice;
+    std::vector<BlockIOThrottleDevice> throttleReadIOPSDevice;
+    std::vector<BlockIOThrottleDevice> throttleWriteIOPSDevice;
+    std::vector<BlockIOLatencyDevice> latencyDevice;
+};
+
+inline void from_json(const nlohmann::json &j, ResourceBlockIO &o)
+{
+    o.weight = j.value("weight", 0);
+    o.weightDevice = j.value("weightDevice", std::vector<BlockIOWeightDevice> {});
+    o.throttleReadBpsDevice = j.value("throttleReadBpsDevice", std::vector<BlockIOThrottleDevice> {});
+    o.throttleWriteBpsDevice = j.value("throttleWriteBpsDevice", std::vector<BlockIOThrottleDevice> {});
+    o.throttleReadIOPSDevice = j.value("throttleReadIOPSDevice", std::vector<BlockIOThrottleDevice> {});
+    o.throttleWriteIOPSDevice = j.value("throttleWriteIOPSDevice", std::vector<BlockIOThrottleDevice> {});
+    o.latencyDevice = j.value("latencyDevice", std::vector<BlockIOLatencyDevice> {});
+}
+
+inline void to_json(nlohmann::json &j, const ResourceBlockIO &o)
+{
+    j["weight"] = o.weight;
+    j["weightDevice"] = o.weightDevice;
+    j["throttleReadBpsDevice"] = o.throttleReadBpsDevice;
+    j["throttleWriteBpsDevice"] = o.throttleWriteBpsDevice;
+    j["throttleReadIOPSDevice"] = o.throttleReadIOPSDevice;
+    j["throttleWriteIOPSDevice"] = o.throttleWriteIOPSDevice;
+    j["latencyDevice"] = o.latencyDevice;
+}
+
 struct Resources {
     ResourceMemory memory;
     ResourceCPU cpu;
+    ResourcePids pids;
+    ResourceBlockIO blockIO;
 };
 
 inline void from_json(const nlohmann::json &j, Resources &o)
 {
     o.cpu = j.value("cpu", ResourceCPU());
     o.memory = j.value("memory", ResourceMemory());
+    o.pids = j.value("pids", ResourcePids());
+    o.blockIO = j.value("blockIO", ResourceBlockIO());
 }
 
 inline void to_json(nlohmann::json &j, const Resources &o)
 {
     j["cpu"] = o.cpu;
     j["memory"] = o.memory;
+    j["pids"] = o.pids;
+    j["blockIO"] = o.blockIO;
 }
 
 struct Linux {
@@ -504,11 +626,58 @@ LLJS_TO_OBJ(DbusProxyInfo)
     LLJS_TO(interface);
 }
 
+// publish cgroup stats to the reader every interval milliseconds
+struct AnnotationsStats {
+    uint64_t interval = 0;
+    // send counters as increments since the last message, and only what changed
+    bool delta = false;
+};
+
+LLJS_FROM_OBJ(AnnotationsStats)
+{
+    o.interval = j.value("interval", 0);
+    o.delta = j.value("delta", false);
+}
+
+LLJS_TO_OBJ(AnnotationsStats)
+{
+    LLJS_TO(interval);
+    LLJS_TO(delta);
+}
+
+// psi triggers such as "some 150000 1000000" and memory.events to watch, events are sent to the reader
+struct AnnotationsPressure {
+    tl::optional<std::string> cpu;
+    tl::optional<std::string> memory;
+    tl::optional<std::string> io;
+    bool memory_events = false;
+};
+
+LLJS_FROM_OBJ(AnnotationsPressure)
+{
+    LLJS_FROM_OPT(cpu);
+    LLJS_FROM_OPT(memory);
+    LLJS_FROM_OPT(io);
+    o.memory_events = j.value("memoryEvents", false);
+}
+
+LLJS_TO_OBJ(AnnotationsPressure)
+{
+    LLJS_TO(cpu);
+    LLJS_TO(memory);
+    LLJS_TO(io);
+    LLJS_TO_VARNAME(memoryEvents, memory_events);
+}
+
 struct Annotations {
     std::string container_root_path;
     tl::optional<AnnotationsOverlayfs> overlayfs;
     tl::optional<AnnotationsNativeRootfs> native;
     tl::optional<DbusProxyInfo> dbus_proxy_info;
+    // write a launch trace to this directory, see util/trace.h
+    tl::optional<std::string> trace_dir;
+    tl::optional<AnnotationsStats> stats;
+    tl::optional<AnnotationsPressure> pressure;
 };
 
 LLJS_FROM_OBJ(Annotations)
@@ -517,6 +686,9 @@ LLJS_FROM_OBJ(Annotations)
     LLJS_FROM_OPT(overlayfs);
     LLJS_FROM_OPT(native);
     LLJS_FROM_OPT_VARNAME(dbusProxyInfo, dbus_proxy_info);
+    LLJS_FROM_OPT_VARNAME(traceDir, trace_dir);
+    LLJS_FROM_OPT(stats);
+    LLJS_FROM_OPT(pressure);
 }
 
 LLJS_TO_OBJ(Annotations)
@@ -525,6 +697,9 @@ LLJS_TO_OBJ(Annotations)
     LLJS_TO(overlayfs);
     LLJS_TO(native);
     LLJS_TO_VARNAME(dbusProxyInfo, dbus_proxy_info);
+    LLJS_TO_VARNAME(traceDir, trace_dir);
+    LLJS_TO(stats);
+    LLJS_TO(pressure);
 }
 
 struct Runtime {
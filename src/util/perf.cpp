@@ -0,0 +1,289 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "perf.h"
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "common.h"
+#include "logger.h"
+
+namespace linglong {
+namespace util {
+namespace perf {
+
+namespace {
+
+const size_t kMaxPhases = 64;
+const size_t kPhaseNameSize = 48;
+
+enum PhaseState : uint32_t {
+    kFree,
+    kNaming,
+    kNamed,
+};
+
+struct Phase {
+    std::atomic<uint32_t> state;
+    char name[kPhaseNameSize];
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> values[kValueCount];
+};
+
+enum Source : uint32_t {
+    kPerf = 1 << 0,
+    kPmu = 1 << 1,
+    kRusage = 1 << 2,
+};
+
+struct Table {
+    // Source of counters read by any thread
+    std::atomic<uint32_t> sources;
+    Phase phases[kMaxPhases];
+};
+
+Table *table = nullptr;
+
+// events of the group, the leader first. Page faults of a group led by task-clock read 0 on some kernels, so the
+// leader is page faults.
+const struct {
+    uint32_t type;
+    uint64_t config;
+    Value value;
+} kEvents[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, kPageFaults},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, kTaskClock},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, kCycles},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, kContextSwitches},
+};
+const size_t kEventCount = sizeof(kEvents) / sizeof(kEvents[0]);
+
+// perf fds of a thread, they count the thread which opened them, so a child opens its own
+struct Group {
+    pid_t owner;
+    int fds[kEventCount];
+    // values of the group read in the order events are opened
+    Value order[kEventCount];
+    size_t size;
+};
+
+thread_local Group group = {0, {-1, -1, -1, -1}, {}, 0};
+
+int OpenEvent(size_t i, int leader)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = kEvents[i].type;
+    attr.config = kEvents[i].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        // perf_event_paranoid 2 allows user space only
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+    }
+    return fd;
+}
+
+void CloseGroup()
+{
+    for (auto &fd : group.fds) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    group.size = 0;
+}
+
+void OpenGroup(pid_t tid)
+{
+    CloseGroup();
+    group.owner = tid;
+
+    for (size_t i = 0; i < kEventCount; ++i) {
+        int fd = OpenEvent(i, group.size ? group.fds[0] : -1);
+        if (fd < 0) {
+            // no PMU in a vm gives ENOENT for cycles
+            logDbg() << "perf_event_open" << kEvents[i].type << kEvents[i].config << "failed" << errnoString();
+            if (i == 0) {
+                return;
+            }
+            continue;
+        }
+        group.fds[group.size] = fd;
+        group.order[group.size] = kEvents[i].value;
+        ++group.size;
+        if (kEvents[i].value == kCycles) {
+            table->sources.fetch_or(kPmu, std::memory_order_relaxed);
+        }
+    }
+    table->sources.fetch_or(kPerf, std::memory_order_relaxed);
+}
+
+uint64_t Microseconds(const struct timeval &tv)
+{
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000ULL + static_cast<uint64_t>(tv.tv_usec);
+}
+
+Phase *FindPhase(const char *name)
+{
+    for (auto &phase : table->phases) {
+        auto state = phase.state.load(std::memory_order_acquire);
+        if (state == kFree) {
+            uint32_t expected = kFree;
+            if (phase.state.compare_exchange_strong(expected, kNaming)) {
+                snprintf(phase.name, sizeof(phase.name), "%s", name);
+                phase.state.store(kNamed, std::memory_order_release);
+                return &phase;
+            }
+            state = expected;
+        }
+        // another process is naming it
+        while (state == kNaming) {
+            sched_yield();
+            state = phase.state.load(std::memory_order_acquire);
+        }
+        if (0 == strncmp(phase.name, name, sizeof(phase.name) - 1)) {
+            return &phase;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+int Open()
+{
+    if (table) {
+        return 0;
+    }
+
+    auto env = getenv("LL_BOX_PERF");
+    if (!env || std::string(env) != "1") {
+        return -1;
+    }
+
+    void *addr = mmap(nullptr, sizeof(Table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        logWan() << "map perf counters failed" << errnoString();
+        return -1;
+    }
+    table = static_cast<Table *>(addr);
+    return 0;
+}
+
+bool Enabled()
+{
+    return table != nullptr;
+}
+
+Sample Read()
+{
+    Sample sample;
+    memset(&sample, 0, sizeof(sample));
+    if (!table) {
+        return sample;
+    }
+
+    auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+    if (group.owner != tid) {
+        OpenGroup(tid);
+    }
+
+    struct rusage usage {
+    };
+    getrusage(RUSAGE_THREAD, &usage);
+    sample.values[kUserTime] = Microseconds(usage.ru_utime) * 1000;
+    sample.values[kSystemTime] = Microseconds(usage.ru_stime) * 1000;
+
+    uint64_t buf[1 + kEventCount];
+    if (group.size && read(group.fds[0], buf, sizeof(buf)) >= static_cast<ssize_t>(sizeof(uint64_t) * 2)) {
+        for (size_t i = 0; i < buf[0] && i < group.size; ++i) {
+            sample.values[group.order[i]] = buf[1 + i];
+        }
+    } else {
+        table->sources.fetch_or(kRusage, std::memory_order_relaxed);
+        sample.values[kTaskClock] = sample.values[kUserTime] + sample.values[kSystemTime];
+        sample.values[kPageFaults] = static_cast<uint64_t>(usage.ru_minflt + usage.ru_majflt);
+        sample.values[kContextSwitches] = static_cast<uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+    }
+    sample.valid = true;
+    return sample;
+}
+
+void Add(const char *name, const Sample &begin, const Sample &end)
+{
+    if (!table || !begin.valid || !end.valid) {
+        return;
+    }
+
+    auto phase = FindPhase(name);
+    if (!phase) {
+        return;
+    }
+    phase->calls.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < kValueCount; ++i) {
+        // the group may be reopened in between
+        if (end.values[i] >= begin.values[i]) {
+            phase->values[i].fetch_add(end.values[i] - begin.values[i], std::memory_order_relaxed);
+        }
+    }
+}
+
+void Reset()
+{
+    CloseGroup();
+    group.owner = 0;
+}
+
+void Report(std::ostream &out)
+{
+    if (!table) {
+        return;
+    }
+
+    auto sources = table->sources.load();
+    out << "ll-box counters by phase, from " << ((sources & kPerf) ? "perf_event_open" : "getrusage");
+    if ((sources & kPerf) && (sources & kRusage)) {
+        out << " and getrusage";
+    }
+    if (!(sources & kPmu)) {
+        out << ", cycles are not available";
+    }
+    out << std::endl;
+    out << format("%-28s %6s %12s %14s %11s %11s %10s %10s", "phase", "calls", "task-clock", "cycles", "page-faults",
+                  "ctx-switch", "user", "system")
+        << std::endl;
+
+    for (auto const &phase : table->phases) {
+        if (phase.state.load(std::memory_order_acquire) != kNamed) {
+            break;
+        }
+        auto value = [&phase](Value v) { return static_cast<unsigned long long>(phase.values[v].load()); };
+        out << format("%-28s %6llu %9.3f ms %14s %11llu %11llu %7.3f ms %7.3f ms", phase.name,
+                      static_cast<unsigned long long>(phase.calls.load()), value(kTaskClock) / 1e6,
+                      (sources & kPmu) ? std::to_string(value(kCycles)).c_str() : "-", value(kPageFaults),
+                      value(kContextSwitches), value(kUserTime) / 1e6, value(kSystemTime) / 1e6)
+            << std::endl;
+    }
+}
+
+} // namespace perf
+} // namespace util
+} // namespace linglong
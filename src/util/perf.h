@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_UTIL_PERF_H_
+#define LINGLONG_BOX_SRC_UTIL_PERF_H_
+
+#include <cstdint>
+#include <ostream>
+
+namespace linglong {
+namespace util {
+namespace perf {
+
+/*!
+ * Counters of the launch phases, to tell whether a slow launch is spending cpu, page faults or kernel time. Enabled by
+ * LL_BOX_PERF=1, the report is written to stderr when ll-box exits.
+ *
+ * Each TRACE_SPAN reads a perf_event_open group of the calling thread when it begins and ends: task-clock, cycles if
+ * the cpu has a PMU, page faults and context switches, and getrusage(RUSAGE_THREAD) for the user and system time. The
+ * group is opened on the first span of a thread. Without perf_event_open, as in a seccomp sandbox, the counters are
+ * taken from getrusage. The differences are added to a table by span name, which is mapped shared before entry is
+ * cloned, so spans of entry, init and the mount workers are all counted. A span includes the spans nested in it.
+ */
+
+enum Value {
+    // nanoseconds
+    kTaskClock,
+    kCycles,
+    kPageFaults,
+    kContextSwitches,
+    // nanoseconds
+    kUserTime,
+    kSystemTime,
+    kValueCount,
+};
+
+struct Sample {
+    uint64_t values[kValueCount];
+    bool valid;
+};
+
+// map the table if LL_BOX_PERF=1, do nothing if it's mapped
+int Open();
+
+bool Enabled();
+
+// counters of the calling thread
+Sample Read();
+
+// add the counters between begin and end to a phase
+void Add(const char *phase, const Sample &begin, const Sample &end);
+
+// drop the counters of the parent, call it first in a child which may share its tid with the parent, such as pid 1
+// cloning a new pid namespace
+void Reset();
+
+void Report(std::ostream &out);
+
+} // namespace perf
+} // namespace util
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_UTIL_PERF_H_ */
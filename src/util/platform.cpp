@@ -6,17 +6,196 @@
 
 #include "platform.h"
 #include "logger.h"
+#include "perf.h"
 #include "util/debug/debug.h"
 
+#include <fcntl.h>
 #include <sched.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
 namespace linglong {
 
 const int kStackSize = (1024 * 1024);
+// the spawned child only runs SpawnChild before exec
+const int kSpawnStackSize = (32 * 1024);
+
+namespace {
+// struct clone_args of linux/sched.h, which is missing in old headers
+struct CloneArgs {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+// size without set_tid and cgroup, known by linux 5.3
+const size_t kCloneArgsSizeVer0 = 64;
+
+struct CloneCall {
+    int (*callback)(void *);
+    void *arg;
+};
+
+// the child of PlatformClone may have the pid of its parent in a new pid namespace
+int CloneMain(void *arg)
+{
+    auto call = static_cast<CloneCall *>(arg);
+    util::Logger::Reset();
+    util::perf::Reset();
+    int ret = call->callback(call->arg);
+    util::Logger::Flush();
+    return ret;
+}
+
+// shared with the child by CLONE_VM
+struct SpawnContext {
+    const util::SpawnArgs *spawn;
+    int procsFd;
+    int chdirErrno;
+    int execErrno;
+};
+
+// clone3 with a stack for the child, which calls fn(arg) on it and exits with its return value. syscall(3) can't do it,
+// the child would return through a frame on the stack it left. Return the pid, or -1 and set errno, ENOSYS on an
+// architecture without the trampoline.
+long Clone3(CloneArgs *args, size_t size, int (*fn)(void *), void *arg)
+{
+#if defined(__x86_64__)
+    register long rax __asm__("rax") = SYS_clone3;
+    register long rdi __asm__("rdi") = reinterpret_cast<long>(args);
+    register long rsi __asm__("rsi") = static_cast<long>(size);
+    register long r12 __asm__("r12") = reinterpret_cast<long>(fn);
+    register long r13 __asm__("r13") = reinterpret_cast<long>(arg);
+    // the child keeps all registers but rax, rcx and r11
+    __asm__ volatile("syscall\n\t"
+                     "testq %%rax, %%rax\n\t"
+                     "jnz 1f\n\t"
+                     "xorl %%ebp, %%ebp\n\t"
+                     "movq %%r13, %%rdi\n\t"
+                     "callq *%%r12\n\t"
+                     "movl %%eax, %%edi\n\t"
+                     "movl $60, %%eax\n\t"
+                     "syscall\n\t"
+                     "hlt\n"
+                     "1:\n\t"
+                     : "+r"(rax)
+                     : "r"(rdi), "r"(rsi), "r"(r12), "r"(r13)
+                     : "rcx", "r11", "cc", "memory");
+    long ret = rax;
+#elif defined(__aarch64__)
+    register long x8 __asm__("x8") = SYS_clone3;
+    register long x0 __asm__("x0") = reinterpret_cast<long>(args);
+    register long x1 __asm__("x1") = static_cast<long>(size);
+    register long x19 __asm__("x19") = reinterpret_cast<long>(fn);
+    register long x20 __asm__("x20") = reinterpret_cast<long>(arg);
+    // the child keeps all registers but x0
+    __asm__ volatile("svc #0\n\t"
+                     "cbnz x0, 1f\n\t"
+                     "mov x29, xzr\n\t"
+                     "mov x0, x20\n\t"
+                     "blr x19\n\t"
+                     "mov x8, #93\n\t"
+                     "svc #0\n"
+                     "1:\n\t"
+                     : "+r"(x0)
+                     : "r"(x8), "r"(x1), "r"(x19), "r"(x20)
+                     : "x30", "cc", "memory");
+    long ret = x0;
+#else
+    (void)args;
+    (void)size;
+    (void)fn;
+    (void)arg;
+    long ret = -ENOSYS;
+#endif
+    if (ret < 0) {
+        errno = static_cast<int>(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+// run by the child of Spawn on the memory of its parent, which is suspended. Only async-signal-safe calls are allowed
+// here, no allocation, no logging.
+int SpawnChild(void *arg)
+{
+    auto ctx = static_cast<SpawnContext *>(arg);
+    auto spawn = ctx->spawn;
+
+    // as posix_spawn does, a handler of the parent must not run on the memory shared with it before exec. The table of
+    // handlers is not shared without CLONE_SIGHAND. Spawn blocks all signals, none is delivered until they are reset.
+    for (int sig = 1; sig < NSIG; ++sig) {
+        struct sigaction action;
+        if (sigaction(sig, nullptr, &action) == 0 && action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL) {
+            action.sa_handler = SIG_DFL;
+            action.sa_flags = 0;
+            sigaction(sig, &action, nullptr);
+        }
+    }
+
+    // the parent blocks signals for its signalfd, and all of them around clone
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+    for (int i = 0; i < 3; ++i) {
+        if (spawn->stdio[i] >= 0 && spawn->stdio[i] != i) {
+            dup2(spawn->stdio[i], i);
+        }
+    }
+
+    // "0" moves the writer itself, a failure leaves it in the cgroup of the parent
+    if (ctx->procsFd >= 0 && write(ctx->procsFd, "0", 1) != 1) {
+        ctx->procsFd = -1;
+    }
+
+    if (!spawn->cwd.empty() && chdir(spawn->cwd.c_str()) != 0) {
+        ctx->chdirErrno = errno;
+    }
+
+    if (spawn->fd >= 0) {
+        syscall(SYS_execveat, spawn->fd, "", spawn->argv.data(), spawn->envp.data(), AT_EMPTY_PATH);
+    }
+
+    // as execvpe, go on with the next path unless the file exists and can't be executed
+    int err = ENOENT;
+    for (const auto &path : spawn->paths) {
+        execve(path.c_str(), spawn->argv.data(), spawn->envp.data());
+        if (errno == EACCES) {
+            err = EACCES;
+        } else if (errno != ENOENT && errno != ENOTDIR) {
+            err = errno;
+            break;
+        }
+    }
+    ctx->execErrno = err;
+    _exit(127);
+}
+} // namespace
 
 namespace util {
 
@@ -33,7 +212,54 @@ int PlatformClone(int (*callback)(void *), int flags, void *arg, ...)
 
     stackTop = stack + kStackSize;
 
-    return clone(callback, stackTop, flags, arg);
+    // the child gets a copy of call, CLONE_VM is not used
+    CloneCall call = {callback, arg};
+    util::Logger::Flush();
+    return clone(CloneMain, stackTop, flags, &call);
+}
+
+int PlatformFork(int flags, int cgroupFd, int *pidfd)
+{
+    CloneArgs args = {};
+    args.flags = static_cast<uint64_t>(flags & ~CSIGNAL);
+    args.exit_signal = static_cast<uint64_t>(flags & CSIGNAL);
+    if (pidfd) {
+        args.flags |= CLONE_PIDFD;
+        args.pidfd = reinterpret_cast<uint64_t>(pidfd);
+    }
+    auto size = kCloneArgsSizeVer0;
+    if (cgroupFd >= 0) {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = static_cast<uint64_t>(cgroupFd);
+        size = sizeof(args);
+    }
+
+    util::Logger::Flush();
+    // no stack, the child continues here with a copy of ours as fork does
+    long pid = syscall(SYS_clone3, &args, size);
+    if (pid == 0) {
+        util::Logger::Reset();
+        util::perf::Reset();
+    }
+    if (pid < 0) {
+        // E2BIG: the kernel doesn't know the cgroup field
+        if (errno == E2BIG) {
+            errno = ENOSYS;
+        }
+        return -1;
+    }
+    return static_cast<int>(pid);
+}
+
+int PlatformClone3(int (*callback)(void *), int flags, void *arg, int cgroupFd, int *pidfd)
+{
+    int pid = PlatformFork(flags, cgroupFd, pidfd);
+    if (pid == 0) {
+        int ret = callback(arg);
+        Logger::Flush();
+        _exit(ret);
+    }
+    return pid;
 }
 
 int Exec(const util::str_vec &args, tl::optional<std::vector<std::string>> env_list)
@@ -55,6 +281,7 @@ int Exec(const util::str_vec &args, tl::optional<std::vector<std::string>> env_l
     }
 
     logDbg() << "execve" << targetArgv[0] << " in pid:" << getpid();
+    Logger::Flush();
 
     int ret = execvpe(targetArgv[0], const_cast<char **>(targetArgv), const_cast<char **>(targetEnvv));
 
@@ -63,6 +290,123 @@ int Exec(const util::str_vec &args, tl::optional<std::vector<std::string>> env_l
     return ret;
 }
 
+SpawnArgs::SpawnArgs(const util::str_vec &args, const util::str_vec &env, const std::string &cwd)
+    : args(args)
+    , env(env)
+    , cwd(cwd)
+{
+    for (auto &arg : this->args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const char *searchPath = nullptr;
+    for (auto &e : this->env) {
+        envp.push_back(const_cast<char *>(e.c_str()));
+        if (e.compare(0, 5, "PATH=") == 0) {
+            searchPath = e.c_str() + 5;
+        }
+    }
+    envp.push_back(nullptr);
+
+    if (args.empty()) {
+        return;
+    }
+    const auto &file = args[0];
+    if (file.find('/') != std::string::npos) {
+        paths.push_back(file);
+        return;
+    }
+    if (!searchPath) {
+        searchPath = getenv("PATH");
+    }
+    // default of execvpe
+    std::string dirs = searchPath ? searchPath : "/bin:/usr/bin";
+    for (const auto &dir : util::str_spilt(dirs, ":")) {
+        // an empty directory is the current one
+        paths.push_back(dir.empty() ? file : dir + "/" + file);
+    }
+}
+
+SpawnArgs::~SpawnArgs()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int Spawn(const SpawnArgs &spawn, int cgroupFd, int *pidfd, int *execErrno)
+{
+    if (spawn.paths.empty()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // the parent is suspended until the child execs, so the stack can live in our frame
+    alignas(16) char stack[kSpawnStackSize];
+    SpawnContext ctx = {&spawn, -1, 0, 0};
+    int fd = -1;
+    // the child can't log, and our records are lost if it execs a process replacing us
+    Logger::Flush();
+
+    CloneArgs args = {};
+    args.flags = CLONE_VM | CLONE_VFORK;
+    args.exit_signal = SIGCHLD;
+    args.stack = reinterpret_cast<uint64_t>(stack);
+    args.stack_size = sizeof(stack);
+    if (pidfd) {
+        args.flags |= CLONE_PIDFD;
+        args.pidfd = reinterpret_cast<uint64_t>(&fd);
+    }
+    auto size = kCloneArgsSizeVer0;
+    if (cgroupFd >= 0) {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = static_cast<uint64_t>(cgroupFd);
+        size = sizeof(args);
+    }
+
+    // restored after clone in the parent, the child sets its own
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    int pid = static_cast<int>(Clone3(&args, size, SpawnChild, &ctx));
+    // E2BIG: the kernel doesn't know the cgroup field. The child of clone moves itself then.
+    if (pid < 0 && (errno == ENOSYS || errno == E2BIG)) {
+        int flags = CLONE_VM | CLONE_VFORK | SIGCHLD | (pidfd ? CLONE_PIDFD : 0);
+        if (cgroupFd >= 0) {
+            ctx.procsFd = openat(cgroupFd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        }
+        int procsFd = ctx.procsFd;
+        pid = clone(SpawnChild, stack + sizeof(stack), flags, &ctx, &fd);
+        if (procsFd >= 0) {
+            close(procsFd);
+        }
+        if (pid >= 0 && cgroupFd >= 0 && ctx.procsFd < 0) {
+            logWan() << "failed to move" << pid << "to cgroup";
+        }
+    }
+    int cloneErrno = errno;
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    if (pid < 0) {
+        errno = cloneErrno;
+        return -1;
+    }
+
+    if (ctx.chdirErrno) {
+        logErr() << "failed to chdir to" << spawn.cwd << strerror(ctx.chdirErrno);
+    }
+    if (pidfd) {
+        // kernels before 5.2 ignore CLONE_PIDFD
+        *pidfd = fd;
+    }
+    if (execErrno) {
+        *execErrno = ctx.execErrno;
+    }
+    return pid;
+}
+
 // if wstatus says child exit normally, return true else false
 static bool parse_wstatus(const int &wstatus, std::string &info)
 {
@@ -84,6 +428,7 @@ static void DoWait(const int pid, int target = 0)
 {
     logDbg() << util::format("DoWait called with pid=%d, target=%d", pid, target);
     int wstatus;
+    Logger::Flush();
     while (int child = waitpid(pid, &wstatus, 0)) {
         if (child > 0) {
             std::string info;
@@ -17,8 +17,44 @@ namespace util {
 
 int PlatformClone(int (*callback)(void *), int flags, void *arg, ...);
 
+// clone3 in fork style, the child runs callback and exits with its return value. flags are those of clone, the exit
+// signal in the low byte. The child is born in the cgroup of cgroupFd unless it's -1, and its pidfd is stored to pidfd
+// unless it's nullptr. Return -1 and set errno to ENOSYS if the kernel can't do it, callers should fall back to
+// PlatformClone then.
+int PlatformClone3(int (*callback)(void *), int flags, void *arg, int cgroupFd = -1, int *pidfd = nullptr);
+// as PlatformClone3, but return 0 in the child as fork does
+int PlatformFork(int flags, int cgroupFd = -1, int *pidfd = nullptr);
+
 int Exec(const util::str_vec &args, tl::optional<std::vector<std::string>> env_list);
 
+// argv, envp and the paths to search args[0] in are built once in the parent, so the child of Spawn makes syscalls only
+struct SpawnArgs {
+    SpawnArgs(const util::str_vec &args, const util::str_vec &env, const std::string &cwd);
+    ~SpawnArgs();
+    SpawnArgs(const SpawnArgs &) = delete;
+    SpawnArgs &operator=(const SpawnArgs &) = delete;
+
+    util::str_vec args;
+    util::str_vec env;
+    std::string cwd;
+    // args[0] if it contains a '/', otherwise args[0] in each directory of PATH of env, or PATH of ours if env has none
+    util::str_vec paths;
+    std::vector<char *> argv;
+    std::vector<char *> envp;
+    // an O_PATH fd of args[0] resolved in advance, it's exec'd with execveat before paths are tried. Owned by SpawnArgs.
+    int fd = -1;
+    // dup'ed to stdin, stdout and stderr of the child unless -1, none of them may be 0, 1 or 2 out of its place. Not
+    // owned by SpawnArgs.
+    int stdio[3] = {-1, -1, -1};
+};
+
+// start a process with clone3(CLONE_VM | CLONE_VFORK), the caller is suspended until the child execs or exits. The
+// child is born in the cgroup of cgroupFd unless it's -1, resets signal handlers and unblocks all signals, changes to
+// cwd and execs fd or the first of paths that works. Without clone3 or CLONE_INTO_CGROUP, it's cloned with clone and
+// moves itself to the cgroup. Return the pid, or -1 if clone failed. If exec failed, the child exits with 127 and its
+// errno is stored to execErrno. pidfd is set to -1 if the kernel can't return it.
+int Spawn(const SpawnArgs &spawn, int cgroupFd = -1, int *pidfd = nullptr, int *execErrno = nullptr);
+
 void Wait(const int pid);
 void WaitAll();
 void WaitAllUntil(const int pid);
@@ -0,0 +1,35 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_UTIL_PROBE_H_
+#define LINGLONG_BOX_SRC_UTIL_PROBE_H_
+
+/*!
+ * USDT probes of the ll_box provider, at the launch phases and around each mount, seccomp load and exec. A probe is a
+ * nop in the code and a note in .note.stapsdt, a tracer attaching to it replaces the nop, so a probe not attached
+ * costs nothing but keeping its arguments in registers. List them with `readelf -n ll-box`, or trace them with
+ * `bpftrace -e 'usdt:/usr/bin/ll-box:ll_box:mount__start { printf("%s\n", str(arg1)); }'`.
+ *
+ * Probes are built when sys/sdt.h of systemtap is found, they are empty otherwise.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define LL_PROBE(name) DTRACE_PROBE(ll_box, name)
+#define LL_PROBE1(name, a) DTRACE_PROBE1(ll_box, name, a)
+#define LL_PROBE2(name, a, b) DTRACE_PROBE2(ll_box, name, a, b)
+#define LL_PROBE3(name, a, b, c) DTRACE_PROBE3(ll_box, name, a, b, c)
+#else
+#define LL_PROBE(name) \
+    do {               \
+    } while (0)
+#define LL_PROBE1(name, a) LL_PROBE(name)
+#define LL_PROBE2(name, a, b) LL_PROBE(name)
+#define LL_PROBE3(name, a, b, c) LL_PROBE(name)
+#endif
+
+#endif /* LINGLONG_BOX_SRC_UTIL_PROBE_H_ */
@@ -0,0 +1,794 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "runtime_cache.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#include "logger.h"
+
+namespace linglong {
+namespace util {
+
+static const char kRuntimeCacheMagic[4] = {'L', 'L', 'R', 'C'};
+static const uint32_t kRuntimeCacheVersion = 5;
+// oldest files are removed beyond this
+static const size_t kRuntimeCacheMaxEntries = 64;
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint64_t contentSize;
+    uint32_t recordsSize;
+    uint32_t stringsSize;
+};
+
+class CacheWriter
+{
+public:
+    void put(uint8_t v) { raw(&v, sizeof(v)); }
+    void put(bool v) { put(static_cast<uint8_t>(v ? 1 : 0)); }
+    void put(uint32_t v) { raw(&v, sizeof(v)); }
+    void put(int32_t v) { raw(&v, sizeof(v)); }
+    void put(uint64_t v) { raw(&v, sizeof(v)); }
+    void put(int64_t v) { raw(&v, sizeof(v)); }
+
+    void put(const std::string &s)
+    {
+        auto it = offsets.find(s);
+        uint32_t offset;
+        if (it != offsets.end()) {
+            offset = it->second;
+        } else {
+            offset = static_cast<uint32_t>(strings.size());
+            strings += s;
+            offsets.insert(std::make_pair(s, offset));
+        }
+        put(offset);
+        put(static_cast<uint32_t>(s.size()));
+    }
+
+    template<typename T>
+    void put(const std::vector<T> &v)
+    {
+        put(static_cast<uint32_t>(v.size()));
+        for (auto const &item : v) {
+            put(item);
+        }
+    }
+
+    template<typename T>
+    void put(const tl::optional<T> &o)
+    {
+        put(o.has_value());
+        if (o.has_value()) {
+            put(*o);
+        }
+    }
+
+    void put(const Root &o)
+    {
+        put(o.path);
+        put(o.readonly);
+    }
+
+    void put(const Process &o)
+    {
+        put(o.args);
+        put(o.env);
+        put(o.cwd);
+    }
+
+    void put(const Mount &o)
+    {
+        put(o.destination);
+        put(o.type);
+        put(o.source);
+        put(o.data);
+        put(static_cast<uint32_t>(o.fsType));
+        put(o.flags);
+    }
+
+    void put(const Namespace &o) { put(static_cast<int32_t>(o.type)); }
+
+    void put(const IDMap &o)
+    {
+        put(o.containerID);
+        put(o.hostID);
+        put(o.size);
+    }
+
+    void put(const SyscallArg &o)
+    {
+        put(static_cast<uint32_t>(o.index));
+        put(static_cast<uint64_t>(o.value));
+        put(static_cast<uint64_t>(o.valueTwo));
+        put(o.op);
+    }
+
+    void put(const Syscall &o)
+    {
+        put(o.names);
+        put(o.action);
+        put(o.args);
+    }
+
+    void put(const Seccomp &o)
+    {
+        put(o.defaultAction);
+        put(o.architectures);
+        put(o.syscalls);
+    }
+
+    void put(const BlockIOWeightDevice &o)
+    {
+        put(o.major);
+        put(o.minor);
+        put(static_cast<uint32_t>(o.weight));
+    }
+
+    void put(const BlockIOThrottleDevice &o)
+    {
+        put(o.major);
+        put(o.minor);
+        put(o.rate);
+    }
+
+    void put(const BlockIOLatencyDevice &o)
+    {
+        put(o.major);
+        put(o.minor);
+        put(o.target);
+    }
+
+    void put(const ResourceBlockIO &o)
+    {
+        put(static_cast<uint32_t>(o.weight));
+        put(o.weightDevice);
+        put(o.throttleReadBpsDevice);
+        put(o.throttleWriteBpsDevice);
+        put(o.throttleReadIOPSDevice);
+        put(o.throttleWriteIOPSDevice);
+        put(o.latencyDevice);
+    }
+
+    void put(const Resources &o)
+    {
+        put(o.memory.limit);
+        put(o.memory.reservation);
+        put(o.memory.swap);
+        put(o.memory.high);
+        put(static_cast<uint64_t>(o.cpu.shares));
+        put(o.cpu.quota);
+        put(static_cast<uint64_t>(o.cpu.period));
+        put(o.pids.limit);
+        put(o.blockIO);
+    }
+
+    void put(const Linux &o)
+    {
+        put(o.namespaces);
+        put(o.uidMappings);
+        put(o.gidMappings);
+        put(o.seccomp);
+        put(o.cgroupsPath);
+        put(o.resources);
+    }
+
+    void put(const Hook &o)
+    {
+        put(o.path);
+        put(o.args);
+        put(o.env);
+    }
+
+    void put(const Hooks &o)
+    {
+        put(o.prestart);
+        put(o.poststart);
+        put(o.poststop);
+    }
+
+    void put(const AnnotationsOverlayfs &o)
+    {
+        put(o.lower_parent);
+        put(o.upper);
+        put(o.workdir);
+        put(o.mounts);
+    }
+
+    void put(const AnnotationsNativeRootfs &o) { put(o.mounts); }
+
+    void put(const DbusProxyInfo &o)
+    {
+        put(o.enable);
+        put(o.bus_type);
+        put(o.app_id);
+        put(o.proxy_path);
+        put(o.name);
+        put(o.path);
+        put(o.interface);
+    }
+
+    void put(const AnnotationsStats &o)
+    {
+        put(o.interval);
+        put(o.delta);
+    }
+
+    void put(const AnnotationsPressure &o)
+    {
+        put(o.cpu);
+        put(o.memory);
+        put(o.io);
+        put(o.memory_events);
+    }
+
+    void put(const Annotations &o)
+    {
+        put(o.container_root_path);
+        put(o.overlayfs);
+        put(o.native);
+        put(o.dbus_proxy_info);
+        put(o.trace_dir);
+        put(o.stats);
+        put(o.pressure);
+    }
+
+    void put(const Runtime &o)
+    {
+        put(o.version);
+        put(o.root);
+        put(o.process);
+        put(o.hostname);
+        put(o.linux);
+        put(o.mounts);
+        put(o.hooks);
+        put(o.annotations);
+    }
+
+    std::string records;
+    std::string strings;
+
+private:
+    void raw(const void *p, size_t size) { records.append(reinterpret_cast<const char *>(p), size); }
+
+    std::unordered_map<std::string, uint32_t> offsets;
+};
+
+// every get checks bounds, a truncated or corrupted file makes ok false instead of reading out of the mapping
+class CacheReader
+{
+public:
+    CacheReader(const char *records, size_t recordsSize, const char *strings, size_t stringsSize)
+        : pos(records)
+        , end(records + recordsSize)
+        , strings(strings)
+        , stringsSize(stringsSize)
+    {
+    }
+
+    bool ok = true;
+
+    void get(uint8_t &v) { raw(&v, sizeof(v)); }
+    void get(uint32_t &v) { raw(&v, sizeof(v)); }
+    void get(int32_t &v) { raw(&v, sizeof(v)); }
+    void get(uint64_t &v) { raw(&v, sizeof(v)); }
+    void get(int64_t &v) { raw(&v, sizeof(v)); }
+
+    void get(bool &v)
+    {
+        uint8_t b = 0;
+        get(b);
+        v = b != 0;
+    }
+
+    void get(std::string &s)
+    {
+        uint32_t offset = 0, size = 0;
+        get(offset);
+        get(size);
+        if (!ok || static_cast<uint64_t>(offset) + size > stringsSize) {
+            ok = false;
+            return;
+        }
+        s.assign(strings + offset, size);
+    }
+
+    template<typename T>
+    void get(std::vector<T> &v)
+    {
+        uint32_t count = 0;
+        get(count);
+        // every item takes at least one byte, it stops a bad count from allocating too much
+        if (!ok || count > static_cast<size_t>(end - pos)) {
+            ok = false;
+            return;
+        }
+        v.resize(count);
+        for (auto &item : v) {
+            get(item);
+        }
+    }
+
+    template<typename T>
+    void get(tl::optional<T> &o)
+    {
+        bool present = false;
+        get(present);
+        if (present) {
+            T value;
+            get(value);
+            o = std::move(value);
+        } else {
+            o = tl::nullopt;
+        }
+    }
+
+    void get(Root &o)
+    {
+        get(o.path);
+        get(o.readonly);
+    }
+
+    void get(Process &o)
+    {
+        get(o.args);
+        get(o.env);
+        get(o.cwd);
+    }
+
+    void get(Mount &o)
+    {
+        uint32_t fsType = 0;
+        get(o.destination);
+        get(o.type);
+        get(o.source);
+        get(o.data);
+        get(fsType);
+        get(o.flags);
+        o.fsType = static_cast<Mount::Type>(fsType);
+    }
+
+    void get(Namespace &o)
+    {
+        int32_t type = 0;
+        get(type);
+        o.type = type;
+    }
+
+    void get(IDMap &o)
+    {
+        get(o.containerID);
+        get(o.hostID);
+        get(o.size);
+    }
+
+    void get(SyscallArg &o)
+    {
+        uint32_t index = 0;
+        uint64_t value = 0, valueTwo = 0;
+        get(index);
+        get(value);
+        get(valueTwo);
+        get(o.op);
+        o.index = index;
+        o.value = value;
+        o.valueTwo = valueTwo;
+    }
+
+    void get(Syscall &o)
+    {
+        get(o.names);
+        get(o.action);
+        get(o.args);
+    }
+
+    void get(Seccomp &o)
+    {
+        get(o.defaultAction);
+        get(o.architectures);
+        get(o.syscalls);
+    }
+
+    void get(BlockIOWeightDevice &o)
+    {
+        uint32_t weight = 0;
+        get(o.major);
+        get(o.minor);
+        get(weight);
+        o.weight = static_cast<uint16_t>(weight);
+    }
+
+    void get(BlockIOThrottleDevice &o)
+    {
+        get(o.major);
+        get(o.minor);
+        get(o.rate);
+    }
+
+    void get(BlockIOLatencyDevice &o)
+    {
+        get(o.major);
+        get(o.minor);
+        get(o.target);
+    }
+
+    void get(ResourceBlockIO &o)
+    {
+        uint32_t weight = 0;
+        get(weight);
+        o.weight = static_cast<uint16_t>(weight);
+        get(o.weightDevice);
+        get(o.throttleReadBpsDevice);
+        get(o.throttleWriteBpsDevice);
+        get(o.throttleReadIOPSDevice);
+        get(o.throttleWriteIOPSDevice);
+        get(o.latencyDevice);
+    }
+
+    void get(Resources &o)
+    {
+        uint64_t shares = 0, period = 0;
+        get(o.memory.limit);
+        get(o.memory.reservation);
+        get(o.memory.swap);
+        get(o.memory.high);
+        get(shares);
+        get(o.cpu.quota);
+        get(period);
+        get(o.pids.limit);
+        get(o.blockIO);
+        o.cpu.shares = shares;
+        o.cpu.period = period;
+    }
+
+    void get(Linux &o)
+    {
+        get(o.namespaces);
+        get(o.uidMappings);
+        get(o.gidMappings);
+        get(o.seccomp);
+        get(o.cgroupsPath);
+        get(o.resources);
+    }
+
+    void get(Hook &o)
+    {
+        get(o.path);
+        get(o.args);
+        get(o.env);
+    }
+
+    void get(Hooks &o)
+    {
+        get(o.prestart);
+        get(o.poststart);
+        get(o.poststop);
+    }
+
+    void get(AnnotationsOverlayfs &o)
+    {
+        get(o.lower_parent);
+        get(o.upper);
+        get(o.workdir);
+        get(o.mounts);
+    }
+
+    void get(AnnotationsNativeRootfs &o) { get(o.mounts); }
+
+    void get(DbusProxyInfo &o)
+    {
+        get(o.enable);
+        get(o.bus_type);
+        get(o.app_id);
+        get(o.proxy_path);
+        get(o.name);
+        get(o.path);
+        get(o.interface);
+    }
+
+    void get(AnnotationsStats &o)
+    {
+        get(o.interval);
+        get(o.delta);
+    }
+
+    void get(AnnotationsPressure &o)
+    {
+        get(o.cpu);
+        get(o.memory);
+        get(o.io);
+        get(o.memory_events);
+    }
+
+    void get(Annotations &o)
+    {
+        get(o.container_root_path);
+        get(o.overlayfs);
+        get(o.native);
+        get(o.dbus_proxy_info);
+        get(o.trace_dir);
+        get(o.stats);
+        get(o.pressure);
+    }
+
+    void get(Runtime &o)
+    {
+        get(o.version);
+        get(o.root);
+        get(o.process);
+        get(o.hostname);
+        get(o.linux);
+        get(o.mounts);
+        get(o.hooks);
+        get(o.annotations);
+    }
+
+    bool atEnd() const { return pos == end; }
+
+private:
+    void raw(void *p, size_t size)
+    {
+        if (!ok || static_cast<size_t>(end - pos) < size) {
+            ok = false;
+            return;
+        }
+        memcpy(p, pos, size);
+        pos += size;
+    }
+
+    const char *pos;
+    const char *end;
+    const char *strings;
+    size_t stringsSize;
+};
+
+RuntimeCache::RuntimeCache(std::string dir)
+    : dir(std::move(dir))
+{
+}
+
+std::string RuntimeCache::DefaultDir()
+{
+    auto env = getenv("LL_BOX_RUNTIME_CACHE");
+    if (env && std::string(env) == "0") {
+        return "";
+    }
+
+    // unset for a setuid ll-box, the environment of its caller could point root anywhere
+    auto xdg = secure_getenv("XDG_RUNTIME_DIR");
+    std::string runtimeDir = (xdg && xdg[0] == '/') ? xdg : format("/run/user/%d", getuid());
+
+    // as the user, so that root never creates or prunes in a tree the caller picked, and the tree stays the user's
+    // for the trace ring and metrics
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+    auto dir = runtimeDir + "/linglong/cache";
+    bool created = fs::create_directories(fs::path(dir), 0700);
+    if (!created) {
+        logDbg() << "create runtime cache dir" << dir << "failed" << errnoString();
+    }
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    if (!created) {
+        return "";
+    }
+
+    // a directory others can write to may hold a forged config
+    for (auto const &path : {runtimeDir + "/linglong", dir}) {
+        struct stat st {
+        };
+        if (0 != lstat(path.c_str(), &st) || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 022)) {
+            logWan() << "runtime cache dir" << path << "is not owned by" << getuid()
+                     << "or writable by others, ignore it";
+            return "";
+        }
+    }
+
+    return dir;
+}
+
+// FNV-1a
+uint64_t RuntimeCache::Hash(const std::string &content)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : content) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::string RuntimeCache::Encode(const std::string &content, const Runtime &runtime)
+{
+    CacheWriter writer;
+    writer.put(runtime);
+
+    CacheHeader header = {};
+    memcpy(header.magic, kRuntimeCacheMagic, sizeof(header.magic));
+    header.version = kRuntimeCacheVersion;
+    header.hash = Hash(content);
+    header.contentSize = content.size();
+    header.recordsSize = static_cast<uint32_t>(writer.records.size());
+    header.stringsSize = static_cast<uint32_t>(writer.strings.size());
+
+    std::string data(reinterpret_cast<const char *>(&header), sizeof(header));
+    data += writer.records;
+    data += writer.strings;
+    return data;
+}
+
+bool RuntimeCache::Decode(const char *data, size_t size, const std::string &content, Runtime &runtime)
+{
+    CacheHeader header = {};
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (0 != memcmp(header.magic, kRuntimeCacheMagic, sizeof(header.magic)) || header.version != kRuntimeCacheVersion
+        || header.contentSize != content.size() || header.hash != Hash(content)
+        || sizeof(header) + static_cast<uint64_t>(header.recordsSize) + header.stringsSize != size) {
+        return false;
+    }
+
+    auto records = data + sizeof(header);
+    CacheReader reader(records, header.recordsSize, records + header.recordsSize, header.stringsSize);
+    Runtime decoded;
+    reader.get(decoded);
+    if (!reader.ok || !reader.atEnd()) {
+        return false;
+    }
+
+    runtime = std::move(decoded);
+    return true;
+}
+
+std::string RuntimeCache::FilePath(uint64_t hash) const
+{
+    return format("%s/%016llx.bin", dir.c_str(), static_cast<unsigned long long>(hash));
+}
+
+bool RuntimeCache::Load(const std::string &content, Runtime &runtime) const
+{
+    if (dir.empty()) {
+        return false;
+    }
+
+    // the dir is the user's, see DefaultDir
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+    int fd = open(FilePath(Hash(content)).c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st {
+    };
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != getuid() || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    auto hit = Decode(static_cast<const char *>(data), size, content, runtime);
+    munmap(data, size);
+    if (!hit) {
+        logWan() << "invalid runtime cache" << FilePath(Hash(content));
+    }
+    return hit;
+}
+
+int RuntimeCache::Store(const std::string &content, const Runtime &runtime) const
+{
+    if (dir.empty()) {
+        return -1;
+    }
+
+    auto path = FilePath(Hash(content));
+    auto tmp = format("%s.%d", path.c_str(), getpid());
+    auto data = Encode(content, runtime);
+
+    // the dir is the user's, see DefaultDir
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+
+    int ret = -1;
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        logDbg() << "create" << tmp << "failed" << errnoString();
+    } else {
+        auto written = write(fd, data.c_str(), data.size());
+        close(fd);
+
+        // readers see the old file or the complete new one
+        if (written != static_cast<ssize_t>(data.size()) || 0 != rename(tmp.c_str(), path.c_str())) {
+            logWan() << "write runtime cache" << path << "failed" << errnoString();
+            unlink(tmp.c_str());
+        } else {
+            Prune();
+            ret = 0;
+        }
+    }
+
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    return ret;
+}
+
+// whether name is one of FilePath, other caches share the dir
+static bool IsCacheFile(const char *name)
+{
+    if (strlen(name) != 16 + strlen(".bin") || 0 != strcmp(name + 16, ".bin")) {
+        return false;
+    }
+    for (int i = 0; i < 16; ++i) {
+        if (!isxdigit(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RuntimeCache::Prune() const
+{
+    auto d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+
+    std::vector<std::pair<time_t, std::string>> files;
+    while (auto entry = readdir(d)) {
+        struct stat st {
+        };
+        if (!IsCacheFile(entry->d_name) || 0 != fstatat(dirfd(d), entry->d_name, &st, AT_SYMLINK_NOFOLLOW)
+            || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        files.push_back(std::make_pair(st.st_mtime, std::string(entry->d_name)));
+    }
+
+    if (files.size() > kRuntimeCacheMaxEntries) {
+        std::sort(files.begin(), files.end());
+        for (size_t i = 0; i < files.size() - kRuntimeCacheMaxEntries; ++i) {
+            unlinkat(dirfd(d), files[i].second.c_str(), 0);
+        }
+    }
+    closedir(d);
+}
+
+} // namespace util
+} // namespace linglong
@@ -0,0 +1,58 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_UTIL_RUNTIME_CACHE_H_
+#define LINGLONG_BOX_SRC_UTIL_RUNTIME_CACHE_H_
+
+#include <string>
+
+#include "oci_runtime.h"
+
+namespace linglong {
+namespace util {
+
+/*!
+ * RuntimeCache keeps parsed Runtime in a binary form, keyed by the hash of the json it was parsed from, so that a
+ * launch with a known config is loaded from a mmap'd file without building the json DOM.
+ *
+ * File layout, all integers are little endian:
+ *   header  | magic "LLRC", u32 version, u64 hash of json, u64 json size, u32 records size, u32 strings size
+ *   records | fixed width fields of Runtime in declaration order, a string is (u32 offset, u32 size) in strings,
+ *           | a vector is u32 count followed by its items, an optional is u8 followed by its value if it's 1
+ *   strings | deduplicated string data
+ *
+ * NOTE: bump kRuntimeCacheVersion whenever a field is added to Runtime or its members.
+ */
+class RuntimeCache
+{
+public:
+    explicit RuntimeCache(std::string dir);
+
+    // $XDG_RUNTIME_DIR/linglong/cache, or /run/user/<uid>/linglong/cache if it's unset or ll-box is setuid, created
+    // with the real uid if not exist. It's shared by all caches of ll-box, which read and write in it with the real uid.
+    // Return empty string if caching is disabled by LL_BOX_RUNTIME_CACHE=0 or the directory is not the user's.
+    static std::string DefaultDir();
+
+    static uint64_t Hash(const std::string &content);
+
+    static std::string Encode(const std::string &content, const Runtime &runtime);
+    static bool Decode(const char *data, size_t size, const std::string &content, Runtime &runtime);
+
+    // return true and fill runtime if content is cached
+    bool Load(const std::string &content, Runtime &runtime) const;
+    int Store(const std::string &content, const Runtime &runtime) const;
+
+private:
+    std::string FilePath(uint64_t hash) const;
+    void Prune() const;
+
+    std::string dir;
+};
+
+} // namespace util
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_UTIL_RUNTIME_CACHE_H_ */
@@ -0,0 +1,158 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "trace.h"
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ctime>
+
+#include "common.h"
+#include "json.h"
+#include "logger.h"
+
+namespace linglong {
+namespace util {
+namespace trace {
+
+static int traceFd = -1;
+
+// not cached, a process cloned with CLONE_NEWPID may get the same pid as its parent
+static uint64_t Pidns()
+{
+    struct stat st {
+    };
+    return (0 == stat("/proc/self/ns/pid", &st)) ? st.st_ino : 0;
+}
+
+static void Write(const std::string &event)
+{
+    auto line = event + ",\n";
+    // O_APPEND makes one write atomic to other processes
+    if (write(traceFd, line.c_str(), line.size()) < 0) {
+        logWan() << "write trace failed" << errnoString();
+    }
+}
+
+static nlohmann::json Event(const char *ph, const char *name, uint64_t ts, const std::string &detail)
+{
+    nlohmann::json event = {
+        {"name", name},
+        {"cat", "ll-box"},
+        {"ph", ph},
+        {"ts", ts},
+        {"pid", Pidns()},
+        {"tid", syscall(SYS_gettid)},
+    };
+    if (!detail.empty()) {
+        event["args"] = {{"detail", detail}};
+    }
+    return event;
+}
+
+int Open(const std::string &dir)
+{
+    if (traceFd >= 0) {
+        return 0;
+    }
+
+    auto path = format("%s/ll-box-%d-%llu.json", dir.c_str(), getpid(), static_cast<unsigned long long>(Now()));
+    // dir is given by the caller, a setuid ll-box must not create files there as root
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+    traceFd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    if (traceFd < 0) {
+        logWan() << "open trace file" << path << "failed" << errnoString();
+        return -1;
+    }
+
+    if (write(traceFd, "[\n", 2) != 2) {
+        logWan() << "write trace failed" << errnoString();
+    }
+    logDbg() << "trace to" << path;
+    return 0;
+}
+
+bool Enabled()
+{
+    return traceFd >= 0;
+}
+
+uint64_t Now()
+{
+    struct timespec ts {
+    };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void Complete(const char *name, uint64_t begin, uint64_t end, const std::string &detail)
+{
+    if (!Enabled()) {
+        return;
+    }
+
+    auto event = Event("X", name, begin, detail);
+    event["dur"] = end - begin;
+    Write(event.dump());
+}
+
+void Instant(const char *name, const std::string &detail)
+{
+    if (!Enabled()) {
+        return;
+    }
+
+    auto event = Event("i", name, Now(), detail);
+    event["s"] = "t";
+    Write(event.dump());
+}
+
+void ThreadName(const char *name)
+{
+    if (!Enabled()) {
+        return;
+    }
+
+    nlohmann::json event = {
+        {"name", "thread_name"},
+        {"ph", "M"},
+        {"pid", Pidns()},
+        {"tid", syscall(SYS_gettid)},
+        {"args", {{"name", name}}},
+    };
+    Write(event.dump());
+}
+
+Span::Span(const char *name, std::string detail)
+    : name(name)
+    , detail(std::move(detail))
+    , begin(Enabled() ? Now() : 0)
+    , counters(perf::Read())
+{
+}
+
+Span::~Span()
+{
+    if (counters.valid) {
+        perf::Add(name, counters, perf::Read());
+    }
+    if (Enabled() && begin) {
+        Complete(name, begin, Now(), detail);
+    }
+}
+
+} // namespace trace
+} // namespace util
+} // namespace linglong
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_UTIL_TRACE_H_
+#define LINGLONG_BOX_SRC_UTIL_TRACE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "perf.h"
+
+namespace linglong {
+namespace util {
+namespace trace {
+
+/*!
+ * Launch tracer, write events in chrome trace format (load it with chrome://tracing or https://ui.perfetto.dev).
+ *
+ * One file is created per launch, the fd is inherited by every process of the box and each event is appended with a
+ * single write, so events of entry, init and children go to the same file without locking. The file is an unterminated
+ * json array, which is allowed by the format.
+ *
+ * pid of an event is the inode of its pid namespace, tid is the thread id in that namespace.
+ */
+
+// start tracing to a new file in dir, created with the real uid. Do nothing if tracing is already enabled.
+int Open(const std::string &dir);
+
+bool Enabled();
+
+// CLOCK_MONOTONIC in microseconds
+uint64_t Now();
+
+void Complete(const char *name, uint64_t begin, uint64_t end, const std::string &detail = "");
+
+void Instant(const char *name, const std::string &detail = "");
+
+// name the current thread in trace viewer
+void ThreadName(const char *name);
+
+class Span
+{
+public:
+    explicit Span(const char *name, std::string detail = "");
+    ~Span();
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+private:
+    const char *name;
+    std::string detail;
+    uint64_t begin;
+    // counters of the span if LL_BOX_PERF=1, see perf.h
+    perf::Sample counters;
+};
+
+} // namespace trace
+} // namespace util
+} // namespace linglong
+
+#define LL_TRACE_CONCAT_(a, b) a##b
+#define LL_TRACE_CONCAT(a, b) LL_TRACE_CONCAT_(a, b)
+
+// trace the rest of the scope
+#define TRACE_SPAN(...) linglong::util::trace::Span LL_TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+
+#endif /* LINGLONG_BOX_SRC_UTIL_TRACE_H_ */
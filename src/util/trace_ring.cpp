@@ -0,0 +1,283 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "trace_ring.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "common.h"
+#include "filesystem.h"
+#include "logger.h"
+
+namespace linglong {
+namespace util {
+namespace trace {
+
+namespace {
+
+const uint32_t kRingVersion = 1;
+// power of 2
+const uint32_t kRingCapacity = 4096;
+
+struct RingHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t recordSize;
+    // count of events ever recorded, the next slot is head % capacity
+    std::atomic<uint64_t> head;
+    // clocks when the ring is opened, to show the wall time of events
+    uint64_t realtime;
+    uint64_t monotonic;
+    int32_t pid;
+    uint8_t reserved[20];
+};
+
+struct RingRecord {
+    // CLOCK_MONOTONIC in nanoseconds, 0 if the slot is never written
+    uint64_t ts;
+    uint32_t event;
+    // pid in the pid namespace of the writer
+    int32_t pid;
+    uint64_t a;
+    uint64_t b;
+};
+
+static_assert(sizeof(RingHeader) == 64, "RingHeader is part of the file format");
+static_assert(sizeof(RingRecord) == 32, "RingRecord is part of the file format");
+
+const size_t kRingFileSize = sizeof(RingHeader) + kRingCapacity * sizeof(RingRecord);
+
+RingHeader *ring = nullptr;
+RingRecord *records = nullptr;
+
+const char *const kEventNames[] = {
+    "launch", "clone-entry", "clone-init", "mount-plan", "mount-step", "mount-done",
+    "pivot-root", "exec", "child-exit", "exit",
+};
+
+static_assert(sizeof(kEventNames) / sizeof(kEventNames[0]) == kRingEventCount, "a RingEvent has no name");
+
+uint64_t ClockNs(clockid_t clock)
+{
+    struct timespec ts {
+    };
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// ring files in dir, the oldest first by the time they are created
+std::vector<std::string> ListRings(const std::string &dir)
+{
+    std::vector<std::pair<struct timespec, std::string>> files;
+    auto d = opendir(dir.c_str());
+    if (!d) {
+        return {};
+    }
+    while (auto entry = readdir(d)) {
+        std::string name = entry->d_name;
+        struct stat st {
+        };
+        if (name.size() < 5 || name.compare(name.size() - 5, 5, ".ring") != 0
+            || 0 != fstatat(dirfd(d), entry->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+            continue;
+        }
+        // ctime is set by O_TRUNC, writes through the mapping don't change it
+        files.push_back(std::make_pair(st.st_ctim, dir + "/" + name));
+    }
+    closedir(d);
+
+    std::sort(files.begin(), files.end(), [](const std::pair<struct timespec, std::string> &l,
+                                             const std::pair<struct timespec, std::string> &r) {
+        return l.first.tv_sec != r.first.tv_sec ? l.first.tv_sec < r.first.tv_sec : l.first.tv_nsec < r.first.tv_nsec;
+    });
+    std::vector<std::string> paths;
+    for (auto &file : files) {
+        paths.push_back(file.second);
+    }
+    return paths;
+}
+
+// keep the latest rings, including the one to create
+void Prune(const std::string &dir)
+{
+    auto rings = ListRings(dir);
+    for (size_t i = 0; i + kTraceRingMaxFiles <= rings.size(); ++i) {
+        unlink(rings[i].c_str());
+    }
+}
+
+} // namespace
+
+std::string RingDir()
+{
+    auto env = getenv("LL_BOX_TRACE_RING");
+    if (env && std::string(env) == "0") {
+        return "";
+    }
+
+    // unset for a setuid ll-box, the environment of its caller could point root anywhere. Checking euid does not
+    // work, it's the real uid here.
+    auto xdg = secure_getenv("XDG_RUNTIME_DIR");
+    std::string runtimeDir = (xdg && xdg[0] == '/') ? xdg : format("/run/user/%d", getuid());
+
+    auto dir = runtimeDir + "/linglong/trace";
+    if (!fs::create_directories(fs::path(dir), 0700)) {
+        logDbg() << "create trace ring dir" << dir << "failed" << errnoString();
+        return "";
+    }
+    return dir;
+}
+
+int OpenRing(const std::string &dir)
+{
+    if (ring) {
+        return 0;
+    }
+
+    // as the user, a setuid ll-box must not create or prune files as root, and the user reads the ring later
+    auto euid = geteuid();
+    if (euid != getuid()) {
+        seteuid(getuid());
+    }
+
+    std::string path;
+    int fd = -1;
+    auto ringDir = dir.empty() ? RingDir() : dir;
+    if (!ringDir.empty()) {
+        Prune(ringDir);
+        path = format("%s/ll-box-%d.ring", ringDir.c_str(), getpid());
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            logDbg() << "open trace ring" << path << "failed" << errnoString();
+        }
+    }
+
+    if (euid != geteuid()) {
+        seteuid(euid);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    void *addr = MAP_FAILED;
+    if (0 == ftruncate(fd, kRingFileSize)) {
+        addr = mmap(nullptr, kRingFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) {
+        logDbg() << "map trace ring" << path << "failed" << errnoString();
+        unlink(path.c_str());
+        return -1;
+    }
+
+    ring = static_cast<RingHeader *>(addr);
+    records = reinterpret_cast<RingRecord *>(ring + 1);
+    ring->version = kRingVersion;
+    ring->capacity = kRingCapacity;
+    ring->recordSize = sizeof(RingRecord);
+    ring->realtime = ClockNs(CLOCK_REALTIME);
+    ring->monotonic = ClockNs(CLOCK_MONOTONIC);
+    ring->pid = getpid();
+    memcpy(ring->magic, "LLTR", sizeof(ring->magic));
+
+    Record(kLaunch, static_cast<uint64_t>(getpid()));
+    return 0;
+}
+
+void Record(RingEvent event, uint64_t a, uint64_t b)
+{
+    if (!ring) {
+        return;
+    }
+
+    auto ts = ClockNs(CLOCK_MONOTONIC);
+    auto seq = ring->head.fetch_add(1, std::memory_order_relaxed);
+    auto &record = records[seq & (kRingCapacity - 1)];
+    record.event = event;
+    record.pid = getpid();
+    record.a = a;
+    record.b = b;
+    // last, a reader takes a record with ts as written
+    record.ts = ts;
+}
+
+std::string LatestRing()
+{
+    auto dir = RingDir();
+    auto rings = dir.empty() ? std::vector<std::string>() : ListRings(dir);
+    return rings.empty() ? "" : rings.back();
+}
+
+const char *RingEventName(uint32_t event)
+{
+    return event < kRingEventCount ? kEventNames[event] : "unknown";
+}
+
+int DumpRing(const std::string &path, std::ostream &out)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    RingHeader header;
+    if (content.size() < sizeof(header)) {
+        logErr() << path << "is not a trace ring";
+        return -1;
+    }
+    memcpy(static_cast<void *>(&header), content.data(), sizeof(header));
+    if (memcmp(header.magic, "LLTR", sizeof(header.magic)) != 0 || header.version != kRingVersion
+        || header.recordSize != sizeof(RingRecord)
+        || content.size() < sizeof(header) + static_cast<size_t>(header.capacity) * sizeof(RingRecord)) {
+        logErr() << path << "is not a trace ring of version" << kRingVersion;
+        return -1;
+    }
+
+    std::vector<RingRecord> events(header.capacity);
+    memcpy(static_cast<void *>(events.data()), content.data() + sizeof(header), header.capacity * sizeof(RingRecord));
+    events.erase(std::remove_if(events.begin(), events.end(), [](const RingRecord &r) { return r.ts == 0; }),
+                 events.end());
+    std::sort(events.begin(), events.end(), [](const RingRecord &l, const RingRecord &r) { return l.ts < r.ts; });
+
+    char started[64] = {};
+    time_t seconds = static_cast<time_t>(header.realtime / 1000000000ULL);
+    struct tm tm {
+    };
+    strftime(started, sizeof(started), "%F %T", localtime_r(&seconds, &tm));
+
+    uint64_t head = header.head.load();
+    out << path << ": ll-box " << header.pid << ", started " << started << ", " << head << " events";
+    if (head > header.capacity) {
+        out << ", " << head - header.capacity << " oldest overwritten";
+    }
+    out << std::endl;
+
+    uint64_t last = header.monotonic;
+    for (auto const &r : events) {
+        out << format("%+12.3f ms %+10.3f ms  pid %-6d %-12s %llu %llu", (r.ts - header.monotonic) / 1e6,
+                      (static_cast<int64_t>(r.ts) - static_cast<int64_t>(last)) / 1e6, r.pid,
+                      RingEventName(r.event), static_cast<unsigned long long>(r.a),
+                      static_cast<unsigned long long>(r.b))
+            << std::endl;
+        last = r.ts;
+    }
+    return 0;
+}
+
+} // namespace trace
+} // namespace util
+} // namespace linglong
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_BOX_SRC_UTIL_TRACE_RING_H_
+#define LINGLONG_BOX_SRC_UTIL_TRACE_RING_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace linglong {
+namespace util {
+namespace trace {
+
+/*!
+ * Always-on binary event ring of a launch, to find out afterwards where an intermittent stall was.
+ *
+ * The ring is a file mapped shared before entry is cloned, so entry, init and the mount workers write to the same
+ * mapping and it outlives the box. Recording an event takes a slot with one atomic add and fills a 32 bytes record,
+ * no syscall but clock_gettime of vdso and getpid. Old events are overwritten when the ring wraps.
+ *
+ * Rings are kept in $XDG_RUNTIME_DIR/linglong/trace, the latest kTraceRingMaxFiles of them, and decoded with
+ * `ll-box trace dump [file]`. LL_BOX_TRACE_RING=0 disables it. A setuid ll-box ignores $XDG_RUNTIME_DIR and creates
+ * the ring with the uid of its caller.
+ */
+
+enum RingEvent : uint32_t {
+    // a: pid of ll-box
+    kLaunch,
+    // a: pid of entry or init, b: errno if clone failed
+    kCloneEntry,
+    kCloneInit,
+    // a: steps, b: syscalls planned
+    kMountPlan,
+    // a: index of the step in plan, b: 1 if it failed
+    kMountStep,
+    // a: 1 if failed
+    kMountDone,
+    kPivotRoot,
+    // a: pid, b: errno if exec failed
+    kExec,
+    // a: pid, b: wait status
+    kChildExit,
+    // entry has exited and ll-box is done
+    kExit,
+    kRingEventCount,
+};
+
+const int kTraceRingMaxFiles = 16;
+
+// map a new ring for this launch in dir, the default dir if it's empty. Do nothing if a ring is mapped.
+int OpenRing(const std::string &dir = "");
+
+// $XDG_RUNTIME_DIR/linglong/trace, or /run/user/<uid>/linglong/trace if it's unset or ll-box is setuid, created if
+// not exist. Return empty string if the ring is disabled by LL_BOX_TRACE_RING=0.
+std::string RingDir();
+
+// record an event, do nothing if no ring is mapped
+void Record(RingEvent event, uint64_t a = 0, uint64_t b = 0);
+
+const char *RingEventName(uint32_t event);
+
+// path of the ring opened last in RingDir(), empty if there is none
+std::string LatestRing();
+
+// decode a ring file, oldest event first
+int DumpRing(const std::string &path, std::ostream &out);
+
+} // namespace trace
+} // namespace util
+} // namespace linglong
+
+#endif /* LINGLONG_BOX_SRC_UTIL_TRACE_RING_H_ */
@@ -0,0 +1,100 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <fstream>
+
+#include "container/cgroup.h"
+#include "util/filesystem.h"
+
+using namespace linglong;
+
+TEST(Cgroup, CpuWeight)
+{
+    EXPECT_EQ(Cgroup::CpuWeight(2), 1u);
+    EXPECT_EQ(Cgroup::CpuWeight(1024), 100u);
+    EXPECT_EQ(Cgroup::CpuWeight(262144), 10000u);
+    EXPECT_LT(Cgroup::CpuWeight(512), Cgroup::CpuWeight(1024));
+}
+
+TEST(Cgroup, OpenApplyRemove)
+{
+    Cgroup cgroup;
+    if (0 != cgroup.Open("ll-box-test-" + std::to_string(getpid()))) {
+        GTEST_SKIP() << "no delegated cgroup v2";
+    }
+    ASSERT_GE(cgroup.Fd(), 0);
+    EXPECT_TRUE(util::fs::exists(cgroup.Path() + "/cgroup.procs"));
+
+    Resources res;
+    res.memory.limit = 64 << 20;
+    res.pids.limit = 32;
+    EXPECT_EQ(cgroup.Apply(res), 0);
+
+    CgroupStats stats;
+    EXPECT_EQ(cgroup.ReadStats(stats), 0);
+    EXPECT_EQ(stats.pids, 0u);
+
+    // an empty cgroup is frozen at once
+    Cgroup app;
+    ASSERT_EQ(cgroup.CreateChild("app", app), 0);
+    EXPECT_EQ(app.Freeze(true), 0);
+    EXPECT_EQ(app.Frozen(), 1);
+    EXPECT_EQ(app.Freeze(false), 0);
+    EXPECT_EQ(app.Frozen(), 0);
+    app.Remove();
+
+    auto path = cgroup.Path();
+    cgroup.Remove();
+    EXPECT_FALSE(util::fs::exists(path));
+}
+
+TEST(Cgroup, IoWeight)
+{
+    EXPECT_EQ(Cgroup::IoWeight(10), 1u);
+    EXPECT_EQ(Cgroup::IoWeight(1000), 10000u);
+    EXPECT_EQ(Cgroup::IoWeight(1), Cgroup::IoWeight(10));
+    EXPECT_LT(Cgroup::IoWeight(100), Cgroup::IoWeight(500));
+}
+
+TEST(Cgroup, PartialUpdate)
+{
+    Cgroup cgroup;
+    if (0 != cgroup.Open("ll-box-test-" + std::to_string(getpid()))) {
+        GTEST_SKIP() << "no delegated cgroup v2";
+    }
+    auto read = [&cgroup](const char *file) {
+        std::ifstream stream(cgroup.Path() + "/" + file);
+        std::string value;
+        std::getline(stream, value);
+        return value;
+    };
+    if (read("memory.max").empty() || read("cpu.max").empty()) {
+        cgroup.Remove();
+        GTEST_SKIP() << "memory or cpu controller is not enabled";
+    }
+
+    Resources res;
+    res.memory.limit = 64 << 20;
+    res.memory.high = 32 << 20;
+    res.cpu.quota = 50000;
+    EXPECT_EQ(cgroup.Apply(res), 0);
+
+    // the limits left out keep their values
+    EXPECT_EQ(cgroup.Update(nlohmann::json::parse(R"({"memory": {"high": 50331648}, "cpu": {"period": 200000}})")), 0);
+    EXPECT_EQ(read("memory.max"), "67108864");
+    EXPECT_EQ(read("memory.high"), "50331648");
+    EXPECT_EQ(read("cpu.max"), "50000 200000");
+
+    EXPECT_EQ(cgroup.Update(nlohmann::json::parse(R"({"cpu": {"quota": -1}})")), 0);
+    EXPECT_EQ(read("cpu.max"), "max 200000");
+    EXPECT_EQ(read("memory.high"), "50331648");
+
+    cgroup.Remove();
+}
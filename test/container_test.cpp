@@ -0,0 +1,258 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+#include "container/container.h"
+#include "container/container_option.h"
+#include "container/exec.h"
+#include "util/util.h"
+
+using namespace linglong;
+
+// a box with the host /usr and /etc, and no /bin
+static Runtime DeferredRuntime(const std::string &dir)
+{
+    auto config = nlohmann::json::parse(R"({
+        "ociVersion": "1.0.1",
+        "hostname": "linglong",
+        "process": {"args": ["true"], "env": ["PATH=/usr/bin:/bin", "BOX=1"], "cwd": "/tmp"},
+        "linux": {"namespaces": [{"type": "pid"}, {"type": "mount"}, {"type": "uts"}],
+                  "uidMappings": [], "gidMappings": []},
+        "annotations": {"native": {"mounts": [
+            {"destination": "/usr", "type": "bind", "source": "/usr", "options": ["ro", "rbind"]},
+            {"destination": "/etc", "type": "bind", "source": "/etc", "options": ["ro", "rbind"]}]}},
+        "mounts": [
+            {"destination": "/proc", "type": "proc", "source": "proc", "options": []},
+            {"destination": "/dev", "type": "tmpfs", "source": "tmpfs", "options": ["nosuid", "mode=0755"]},
+            {"destination": "/tmp", "type": "tmpfs", "source": "tmpfs", "options": []}]
+    })");
+    config["root"] = {{"path", dir + "/root"}};
+    config["annotations"]["containerRootPath"] = dir;
+    config["linux"]["cgroupsPath"] = util::format("ll-box-test-%d", getpid());
+    return config.get<Runtime>();
+}
+
+// messages from init until it closes the reader or nothing comes in 10s
+static std::vector<nlohmann::json> ReadAll(int fd)
+{
+    std::vector<nlohmann::json> messages;
+    std::string buf;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    char data[4096];
+    ssize_t n;
+    while (poll(&pfd, 1, 10000) == 1 && (n = read(fd, data, sizeof(data))) > 0) {
+        buf.append(data, static_cast<size_t>(n));
+        size_t end;
+        while ((end = buf.find('\0')) != std::string::npos) {
+            messages.push_back(nlohmann::json::parse(buf.substr(0, end)));
+            buf.erase(0, end + 1);
+        }
+    }
+    return messages;
+}
+
+// the seccomp tests install filters into the test process
+static bool HasSeccompFilter()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Seccomp:") == 0) {
+            return std::stoi(line.substr(8)) != 0;
+        }
+    }
+    return false;
+}
+
+// run a box and send it messages in one write, init reads them all at once, then call during with the pid of the box.
+// The process is deferred if args is empty. Return the replies until init closes the reader.
+static std::vector<nlohmann::json> RunBox(const std::vector<std::string> &args,
+                                          const std::vector<nlohmann::json> &messages,
+                                          const std::function<void(pid_t)> &during = nullptr)
+{
+    std::vector<nlohmann::json> replies;
+    char dir[] = "/tmp/ll-box-container-XXXXXX";
+    if (!mkdtemp(dir)) {
+        ADD_FAILURE() << "mkdtemp failed";
+        return replies;
+    }
+    auto runtime = DeferredRuntime(dir);
+    if (!args.empty()) {
+        runtime.process.args = args;
+    }
+
+    int sv[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv), 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sv[0]);
+        Option option;
+        option.deferProcess = args.empty();
+        Container container(runtime, std::unique_ptr<util::MessageReader>(new util::MessageReader(sv[1])));
+        _exit(container.Start(option) == 0 ? 0 : 1);
+    }
+    close(sv[1]);
+
+    std::string data;
+    for (auto const &message : messages) {
+        data += message.dump();
+        data.push_back('\0');
+    }
+    EXPECT_EQ(write(sv[0], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+    if (during) {
+        during(pid);
+    }
+
+    replies = ReadAll(sv[0]);
+    close(sv[0]);
+    int status = -1;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(status, 0);
+
+    EXPECT_EQ(system(util::format("rm -rf %s", dir).c_str()), 0);
+    return replies;
+}
+
+static std::vector<nlohmann::json> Replies(const std::vector<nlohmann::json> &replies, const std::string &type)
+{
+    std::vector<nlohmann::json> matched;
+    for (auto const &reply : replies) {
+        if (reply.value("type", "") == type) {
+            matched.push_back(reply);
+        }
+    }
+    return matched;
+}
+
+static nlohmann::json ProcessMessage(const std::vector<std::string> &args)
+{
+    return {{"args", args}, {"env", {"PATH=/usr/bin:/bin"}}, {"cwd", "/"}};
+}
+
+TEST(Container, MessagesInOneWrite)
+{
+    if (geteuid() != 0) {
+        GTEST_SKIP() << "a box needs root";
+    }
+    if (HasSeccompFilter()) {
+        GTEST_SKIP() << "a seccomp filter of another test is installed";
+    }
+
+    // the second process must not wait for more data, init exits when the first one does
+    auto replies = RunBox({}, {ProcessMessage({"true"}), ProcessMessage({"true"})});
+    EXPECT_EQ(Replies(replies, "childExit").size(), 2u);
+}
+
+TEST(Container, FreezeThawInOneWrite)
+{
+    if (geteuid() != 0) {
+        GTEST_SKIP() << "a box needs root";
+    }
+    if (HasSeccompFilter()) {
+        GTEST_SKIP() << "a seccomp filter of another test is installed";
+    }
+
+    // the thaw right behind the freeze must be handled, an app left frozen never exits. Both are answered.
+    auto replies = RunBox({}, {ProcessMessage({"sleep", "0.2"}), {{"type", "freeze"}}, {{"type", "thaw"}}});
+    auto frozen = Replies(replies, "frozen");
+    ASSERT_EQ(frozen.size(), 2u);
+    // an error if the freezer is not available
+    EXPECT_FALSE(frozen.back().value("frozen", false));
+    EXPECT_EQ(Replies(replies, "childExit").size(), 1u);
+}
+
+// the first child of pid, waiting for it up to 5s
+static pid_t Child(pid_t pid)
+{
+    for (int i = 0; i < 50; ++i) {
+        std::ifstream children(util::format("/proc/%d/task/%d/children", pid, pid));
+        pid_t child = 0;
+        if (children >> child) {
+            return child;
+        }
+        usleep(100 * 1000);
+    }
+    return -1;
+}
+
+TEST(Container, Exec)
+{
+    if (geteuid() != 0) {
+        GTEST_SKIP() << "a box needs root";
+    }
+    if (HasSeccompFilter()) {
+        GTEST_SKIP() << "a seccomp filter of another test is installed";
+    }
+
+    setenv("LL_BOX_TEST_HOST", "1", 1);
+    std::string output;
+    int status = -1;
+    RunBox({}, {ProcessMessage({"sleep", "1"})}, [&](pid_t box) {
+        // ll-box, entry, init
+        auto init = Child(Child(box));
+        ASSERT_GT(init, 0);
+
+        int out[2];
+        ASSERT_EQ(pipe(out), 0);
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(out[1], STDOUT_FILENO);
+            Process process;
+            process.args = {"sh", "-c", "echo $BOX $EXTRA $LL_BOX_TEST_HOST; pwd; grep ^0:: /proc/self/cgroup; exit 3"};
+            process.env = {"EXTRA=2"};
+            _exit(ExecInContainer(init, process));
+        }
+        close(out[1]);
+        char buf[256];
+        ssize_t n;
+        while ((n = read(out[0], buf, sizeof(buf))) > 0) {
+            output.append(buf, static_cast<size_t>(n));
+        }
+        close(out[0]);
+        waitpid(pid, &status, 0);
+    });
+    unsetenv("LL_BOX_TEST_HOST");
+
+    // the environment and cwd of the box, not of the host
+    EXPECT_EQ(output.substr(0, output.find('\n', output.find('\n') + 1) + 1), "1 2\n/tmp\n");
+    // born in the app cgroup, if the box has one
+    auto cgroup = output.substr(output.find("/tmp\n") + 5);
+    EXPECT_TRUE(cgroup.empty() || cgroup.find("/app\n") != std::string::npos) << cgroup;
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 3);
+}
+
+TEST(Container, MissingProcess)
+{
+    if (geteuid() != 0) {
+        GTEST_SKIP() << "a box needs root";
+    }
+    if (HasSeccompFilter()) {
+        GTEST_SKIP() << "a seccomp filter of another test is installed";
+    }
+
+    auto replies = RunBox({"true"}, {});
+    EXPECT_EQ(Replies(replies, "childExit").size(), 1u);
+
+    // none of /usr/bin and /bin has it, the launch fails before init starts
+    replies = RunBox({"ll-box-test-missing"}, {});
+    EXPECT_TRUE(Replies(replies, "childExit").empty());
+    // a path the plan can't tell about is left to exec, which fails in init
+    replies = RunBox({"/tmp/missing"}, {});
+    ASSERT_EQ(Replies(replies, "childExit").size(), 1u);
+}
@@ -0,0 +1,48 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "util/filesystem.h"
+
+using namespace linglong;
+
+TEST(Filesystem, WaitUntilExist)
+{
+    char dir[] = "/tmp/ll-box-wait-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    auto file = util::fs::path(dir) / "socket";
+
+    // timeout
+    EXPECT_EQ(util::fs::wait_until_exist(file, -1, 20), -1);
+
+    // woken up by creation, not by timeout
+    auto begin = std::chrono::steady_clock::now();
+    std::thread creator([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        close(open(file.string().c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644));
+    });
+    EXPECT_EQ(util::fs::wait_until_exist(file, -1, 5000), 0);
+    creator.join();
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(1));
+    unlink(file.string().c_str());
+
+    // fd readable
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], "r", 1), 1);
+    EXPECT_EQ(util::fs::wait_until_exist(file, fds[0], 5000), 1);
+    close(fds[0]);
+    close(fds[1]);
+
+    rmdir(dir);
+}
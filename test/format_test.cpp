@@ -0,0 +1,101 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cinttypes>
+
+#include "util/common.h"
+
+using namespace linglong;
+
+// util::format before it took a literal, to compare with
+static std::string LegacyFormat(const std::string fmt, ...)
+{
+    int n = ((int)fmt.size()) * 2;
+    std::unique_ptr<char[]> formatted;
+    va_list ap;
+    while (true) {
+        formatted.reset(new char[n]);
+        strcpy(&formatted[0], fmt.c_str());
+        va_start(ap, fmt);
+        int final_n = vsnprintf(&formatted[0], n, fmt.c_str(), ap);
+        va_end(ap);
+        if (final_n < 0 || final_n >= n)
+            n += abs(final_n - n + 1);
+        else
+            break;
+    }
+    return std::string {formatted.get()};
+}
+
+TEST(Format, Long)
+{
+    std::string path(1000, 'a');
+    auto text = util::format("/proc/%d/%s/%" PRIu64, 1, path.c_str(), uint64_t(1) << 40);
+    EXPECT_EQ(text, "/proc/1/" + path + "/1099511627776");
+    EXPECT_EQ(text.size(), strlen(text.c_str()));
+    EXPECT_EQ(util::format("%s", ""), "");
+}
+
+TEST(Format, AppendAndTo)
+{
+    std::string record = "ERR |";
+    util::format_append(record, " %s:%d", "Start", 42);
+    util::format_append(util::format_append(record, " %s", std::string(300, 'b').c_str()), "!");
+    EXPECT_EQ(record, "ERR | Start:42 " + std::string(300, 'b') + "!");
+
+    char buf[8];
+    EXPECT_EQ(util::format_to(buf, sizeof(buf), "%d", 1234), 4);
+    EXPECT_STREQ(buf, "1234");
+    // truncated as snprintf, the length needed is returned
+    EXPECT_EQ(util::format_to(buf, sizeof(buf), "%s", "0123456789"), 10);
+    EXPECT_STREQ(buf, "0123456");
+}
+
+// timing only, run it with --gtest_also_run_disabled_tests
+TEST(Format, DISABLED_Benchmark)
+{
+    const int count = 200000;
+    const char *id = "org.deepin.calculator";
+
+    auto run = [&](int which) {
+        size_t total = 0;
+        char buf[64];
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i) {
+            switch (which) {
+            case 0:
+                total += LegacyFormat("/proc/%d/ns/%s", i, "mnt").size();
+                total += LegacyFormat("%d %d %d\n", i, 1000, 1).size();
+                total += LegacyFormat("%s/%016llx.bin", id, static_cast<unsigned long long>(i)).size();
+                break;
+            case 1:
+                total += util::format("/proc/%d/ns/%s", i, "mnt").size();
+                total += util::format("%d %d %d\n", i, 1000, 1).size();
+                total += util::format("%s/%016llx.bin", id, static_cast<unsigned long long>(i)).size();
+                break;
+            default:
+                total += util::format_to(buf, sizeof(buf), "/proc/%d/ns/%s", i, "mnt");
+                total += util::format_to(buf, sizeof(buf), "%d %d %d\n", i, 1000, 1);
+                total += util::format_to(buf, sizeof(buf), "%s/%016llx.bin", id, static_cast<unsigned long long>(i));
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        EXPECT_GT(total, 0u);
+        return elapsed.count() * 1e9 / (count * 3);
+    };
+
+    auto legacy = run(0);
+    auto formatted = run(1);
+    auto formattedTo = run(2);
+    RecordProperty("legacy_ns", static_cast<int>(legacy));
+    RecordProperty("format_ns", static_cast<int>(formatted));
+    RecordProperty("format_to_ns", static_cast<int>(formattedTo));
+    std::cout << "legacy format: " << static_cast<int>(legacy) << " ns, format: " << static_cast<int>(formatted)
+              << " ns, format_to: " << static_cast<int>(formattedTo) << " ns" << std::endl;
+}
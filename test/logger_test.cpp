@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util/logger.h"
+
+using namespace linglong;
+
+static int formatted = 0;
+
+static std::string Argument()
+{
+    ++formatted;
+    return "argument";
+}
+
+TEST(Logger, DisabledLevel)
+{
+    if (util::Logger::Enabled(util::Logger::Debug)) {
+        GTEST_SKIP() << "LINGLONG_LOG_LEVEL enables Debug";
+    }
+
+    // arguments of a disabled record are not even evaluated
+    logDbg() << Argument();
+    EXPECT_EQ(formatted, 0);
+
+    EXPECT_TRUE(util::Logger::Enabled(util::Logger::Fatal));
+}
+
+TEST(Logger, ForkedChild)
+{
+    auto pidns = util::GetPidnsPid();
+    EXPECT_NE(pidns.find(std::to_string(getpid())), std::string::npos);
+
+    int pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        // the cached pid namespace identity belongs to the parent
+        auto child = util::GetPidnsPid();
+        util::Logger::Flush();
+        _exit(child.find(std::to_string(getpid())) != std::string::npos ? 0 : 1);
+    }
+
+    int wstatus = 0;
+    ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+    EXPECT_TRUE(WIFEXITED(wstatus));
+    EXPECT_EQ(WEXITSTATUS(wstatus), 0);
+}
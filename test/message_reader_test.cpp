@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util/message_reader.h"
+
+using namespace linglong;
+
+TEST(MessageReader, Framing)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    util::MessageReader writer(sv[0]);
+    util::MessageReader reader(sv[1]);
+
+    // both arrive in one read, the second must not wait for more data
+    writer.write(R"({"type":"a"})");
+    writer.write(R"({"type":"b"})");
+    EXPECT_FALSE(reader.pending());
+    EXPECT_EQ(reader.read()["type"], "a");
+    EXPECT_TRUE(reader.pending());
+    EXPECT_EQ(reader.read()["type"], "b");
+    EXPECT_FALSE(reader.pending());
+
+    writer.writeChildExit(7, "sh", 0, "exited");
+    auto message = reader.read();
+    EXPECT_EQ(message["type"], "childExit");
+    EXPECT_EQ(message["pid"], 7);
+
+    // fill reads once, a message split over two writes is pending only when its end is read
+    EXPECT_EQ(::write(sv[0], R"({"type")", 7), 7);
+    EXPECT_EQ(reader.fill(), 7);
+    EXPECT_FALSE(reader.pending());
+    writer.write(R"(:"c"})");
+    EXPECT_GT(reader.fill(), 0);
+    EXPECT_TRUE(reader.pending());
+    EXPECT_EQ(reader.read()["type"], "c");
+
+    shutdown(sv[0], SHUT_WR);
+    EXPECT_EQ(reader.fill(), 0);
+    EXPECT_EQ(reader.readRaw(), "");
+}
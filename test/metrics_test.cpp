@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+
+#include "util/util.h"
+#include "util/metrics.h"
+
+using namespace linglong;
+
+static std::string ReadAll(const std::string &path)
+{
+    std::ifstream f(path);
+    return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+// a launch in a child process, which has its own counters
+static void Launch(const std::string &dir, bool failed)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (0 != util::metrics::Open(dir)) {
+            _exit(1);
+        }
+        util::metrics::Add(util::metrics::kMounts, 3);
+        // counters are shared with child processes
+        pid_t child = fork();
+        if (child == 0) {
+            util::metrics::Add(util::metrics::kChildren);
+            util::metrics::Observe(util::metrics::kTimeToExec, 30 * 1000 * 1000);
+            _exit(0);
+        }
+        waitpid(child, nullptr, 0);
+        if (failed) {
+            util::metrics::Fail(util::metrics::kMount);
+        }
+
+        auto path = util::format("%s/ll-box-%d.prom", dir.c_str(), getpid());
+        if (0 != util::metrics::Write()
+            || ReadAll(path).find(util::format("ll_box_children{pid=\"%d\"} 1\n", getpid())) == std::string::npos) {
+            _exit(2);
+        }
+        if (0 != util::metrics::Write(true) || access(path.c_str(), F_OK) == 0) {
+            _exit(3);
+        }
+        _exit(0);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(status, 0);
+}
+
+TEST(Metrics, Rollup)
+{
+    char dir[] = "/tmp/ll-box-metrics-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    Launch(dir, false);
+    Launch(dir, true);
+
+    auto rollup = ReadAll(util::format("%s/ll-box.prom", dir));
+    EXPECT_NE(rollup.find("# TYPE ll_box_launches_total counter\nll_box_launches_total 2\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_mounts_total 6\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_children_total 2\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_launch_failures_total{phase=\"mount\"} 1\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_launch_failures_total{phase=\"exec\"} 0\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_time_to_exec_seconds_bucket{le=\"0.025\"} 0\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_time_to_exec_seconds_bucket{le=\"0.05\"} 2\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_time_to_exec_seconds_bucket{le=\"+Inf\"} 2\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_time_to_exec_seconds_sum 0.060000\n"), std::string::npos);
+    EXPECT_NE(rollup.find("\nll_box_time_to_exec_seconds_count 2\n"), std::string::npos);
+    // a gauge of an instance is not summed up
+    EXPECT_EQ(rollup.find("ll_box_children "), std::string::npos);
+
+    unlink(util::format("%s/ll-box.prom", dir).c_str());
+    unlink(util::format("%s/ll-box.lock", dir).c_str());
+    EXPECT_EQ(rmdir(dir), 0);
+}
+
+TEST(Metrics, Watch)
+{
+    char dir[] = "/tmp/ll-box-metrics-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (0 != util::metrics::Open(dir) || 0 != util::metrics::Write()) {
+            _exit(1);
+        }
+        util::metrics::Watch();
+
+        // a child started after the file is written, as by init
+        pid_t child = fork();
+        if (child == 0) {
+            util::metrics::Add(util::metrics::kChildren);
+            _exit(0);
+        }
+        waitpid(child, nullptr, 0);
+
+        auto path = util::format("%s/ll-box-%d.prom", dir, getpid());
+        auto expected = util::format("ll_box_children{pid=\"%d\"} 1\n", getpid());
+        bool found = false;
+        for (int i = 0; i < 50 && !found; ++i) {
+            usleep(100 * 1000);
+            found = ReadAll(path).find(expected) != std::string::npos;
+        }
+        if (0 != util::metrics::Write(true)) {
+            _exit(3);
+        }
+        _exit(found ? 0 : 2);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(status, 0);
+
+    unlink(util::format("%s/ll-box.prom", dir).c_str());
+    unlink(util::format("%s/ll-box.lock", dir).c_str());
+    EXPECT_EQ(rmdir(dir), 0);
+}
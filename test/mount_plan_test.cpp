@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+
+#include "util/oci_runtime.h"
+
+#include "container/mount/mount_plan.h"
+
+using namespace linglong;
+
+static Mount makeMount(const std::string &type, const std::string &source, const std::string &destination)
+{
+    nlohmann::json j = {{"type", type}, {"source", source}, {"destination", destination}};
+    return j.get<Mount>();
+}
+
+TEST(MountPlan, Compile)
+{
+    std::vector<Mount> mounts = {
+        makeMount("bind", "/etc", "/tmp/a/b"),   makeMount("tmpfs", "tmpfs", "/dev/shm"),
+        makeMount("tmpfs", "tmpfs", "/dev"),     makeMount("devpts", "devpts", "/dev/pts"),
+        makeMount("tmpfs", "tmpfs", "/run/user"), makeMount("bind", "/etc/hostname", "/run/user/1000/hostname"),
+    };
+
+    auto plan = MountPlan::Compile(mounts);
+    auto const &steps = plan.Steps();
+
+    // /dev/shm is shadowed by /dev
+    ASSERT_EQ(steps.size(), 5);
+
+    EXPECT_EQ(steps[0].mount.destination, "/dev");
+    EXPECT_EQ(steps[1].mount.destination, "/dev/pts");
+    EXPECT_EQ(steps[2].mount.destination, "/run/user");
+    EXPECT_EQ(steps[3].mount.destination, "/tmp/a/b");
+    EXPECT_EQ(steps[4].mount.destination, "/run/user/1000/hostname");
+
+    // /dev/pts lives on the tmpfs of /dev, /run is created once
+    EXPECT_EQ(steps[1].directories, util::str_vec({"/dev/pts"}));
+    EXPECT_EQ(steps[2].directories, util::str_vec({"/run", "/run/user"}));
+    EXPECT_EQ(steps[3].directories, util::str_vec({"/tmp", "/tmp/a", "/tmp/a/b"}));
+
+    // regular file is mounted on a new empty file
+    EXPECT_TRUE(steps[4].touch);
+    EXPECT_EQ(steps[4].directories, util::str_vec({"/run/user/1000"}));
+
+    EXPECT_LT(plan.SyscallCount(), plan.LegacySyscallCount());
+
+    // /dev, /run/user and /tmp/a/b can be mounted concurrently
+    auto groups = plan.Subtrees();
+    ASSERT_EQ(groups.size(), 3);
+    EXPECT_EQ(groups[0], std::vector<size_t>({0, 1}));
+    EXPECT_EQ(groups[1], std::vector<size_t>({2, 4}));
+    EXPECT_EQ(groups[2], std::vector<size_t>({3}));
+}
+
+TEST(MountPlan, Resolve)
+{
+    char tmpl[] = "/tmp/ll-mount-plan-XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    std::string usr = std::string(tmpl) + "/usr";
+    ASSERT_EQ(mkdir(usr.c_str(), 0755), 0);
+    ASSERT_EQ(mkdir((usr + "/bin").c_str(), 0755), 0);
+    std::ofstream(usr + "/bin/app") << "app";
+    ASSERT_EQ(symlink("/usr/bin/app", (usr + "/bin/absolute").c_str()), 0);
+    ASSERT_EQ(symlink("app", (usr + "/bin/relative").c_str()), 0);
+    ASSERT_EQ(symlink("/tmp/loop", (usr + "/bin/loop").c_str()), 0);
+    ASSERT_EQ(mkdir((usr + "/lib").c_str(), 0755), 0);
+    std::ofstream(usr + "/lib/libc") << "libc";
+    ASSERT_EQ(symlink("lib", (usr + "/lib64").c_str()), 0);
+
+    std::vector<Mount> mounts = {
+        makeMount("bind", usr, "/usr"),
+        makeMount("tmpfs", "tmpfs", "/tmp"),
+        makeMount("bind", "/proc/self/exe", "/usr/share/app/exe"),
+        makeMount("bind", "/proc/self/exe", "/usr/lib64/ld/exe"),
+    };
+    auto plan = MountPlan::Compile(mounts);
+    plan.Link("/usr/bin", "/bin");
+
+    std::string hostPath;
+    const MountStep *step = nullptr;
+    EXPECT_EQ(plan.Resolve("/usr/bin/app", hostPath, &step), 1);
+    EXPECT_EQ(hostPath, usr + "/bin/app");
+    ASSERT_NE(step, nullptr);
+    EXPECT_EQ(step->mount.destination, "/usr");
+
+    // symlinks are followed in the container, not on host
+    hostPath.clear();
+    EXPECT_EQ(plan.Resolve("/usr/bin/absolute", hostPath), 1);
+    EXPECT_EQ(hostPath, usr + "/bin/app");
+    hostPath.clear();
+    EXPECT_EQ(plan.Resolve("/bin/relative", hostPath), 1);
+    EXPECT_EQ(hostPath, usr + "/bin/app");
+    hostPath.clear();
+    EXPECT_EQ(plan.Resolve("/usr/share/../bin/./app", hostPath), 1);
+    EXPECT_EQ(hostPath, usr + "/bin/app");
+
+    EXPECT_EQ(plan.Resolve("/usr/bin/missing", hostPath), 0);
+    EXPECT_EQ(plan.Resolve("/opt/app", hostPath), 0);
+    // files on a tmpfs are made after the plan is done
+    EXPECT_EQ(plan.Resolve("/tmp/app", hostPath), -1);
+    EXPECT_EQ(plan.Resolve("/usr/bin/loop", hostPath), -1);
+    // mount point created by the plan
+    EXPECT_EQ(plan.Resolve("/usr/share/app", hostPath), -1);
+    // a mount point under a symlink lands on its target, the plan doesn't follow it
+    EXPECT_EQ(plan.Resolve("/usr/lib64/libc", hostPath), -1);
+    EXPECT_EQ(plan.Resolve("/usr/lib64/ld/exe", hostPath), -1);
+    hostPath.clear();
+    EXPECT_EQ(plan.Resolve("/usr/lib/libc", hostPath), 1);
+    EXPECT_EQ(hostPath, usr + "/lib/libc");
+
+    std::string rm = std::string("rm -rf ") + tmpl;
+    EXPECT_EQ(system(rm.c_str()), 0);
+}
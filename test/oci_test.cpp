@@ -6,6 +6,8 @@
 
 #include <gtest/gtest.h>
 
+#include <cinttypes>
+
 #include "util/oci_runtime.h"
 
 using namespace linglong;
@@ -49,7 +51,7 @@ TEST(OCI, Runtime)
 TEST(OCI, Util)
 {
     EXPECT_EQ(util::format("%d %d %d\n", 1, 1, 1), "1 1 1\n");
-    EXPECT_EQ(util::format("%d %d %d\n", uint64_t(1), 1u, 1), "1 1 1\n");
+    EXPECT_EQ(util::format("%" PRIu64 " %u %d\n", uint64_t(1), 1u, 1), "1 1 1\n");
 }
 
 TEST(OCI, JSON)
@@ -62,3 +64,24 @@ TEST(OCI, JSON)
 
     EXPECT_EQ(j.at("hooks").is_null(), true);
 }
+
+TEST(OCI, BlockIO)
+{
+    auto j = nlohmann::json::parse(R"({
+        "blockIO": {
+            "weight": 500,
+            "weightDevice": [{"major": 8, "minor": 0, "weight": 100}],
+            "throttleReadBpsDevice": [{"major": 8, "minor": 0, "rate": 1048576}],
+            "throttleWriteIOPSDevice": [{"major": 8, "minor": 16, "rate": 300}],
+            "latencyDevice": [{"major": 8, "minor": 0, "target": 10000}]
+        }
+    })");
+    auto res = j.get<Resources>();
+
+    EXPECT_EQ(res.blockIO.weight, 500);
+    EXPECT_EQ(res.blockIO.weightDevice.at(0).weight, 100);
+    EXPECT_EQ(res.blockIO.throttleReadBpsDevice.at(0).rate, 1048576u);
+    EXPECT_EQ(res.blockIO.throttleWriteIOPSDevice.at(0).minor, 16);
+    EXPECT_EQ(res.blockIO.throttleWriteBpsDevice.size(), 0u);
+    EXPECT_EQ(res.blockIO.latencyDevice.at(0).target, 10000u);
+}
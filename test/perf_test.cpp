@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <sstream>
+
+#include "util/perf.h"
+#include "util/trace.h"
+
+using namespace linglong;
+
+static void Work()
+{
+    // page faults and cpu time
+    size_t size = 4 << 20;
+    auto addr = static_cast<char *>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(addr, MAP_FAILED);
+    for (size_t i = 0; i < size; i += 4096) {
+        addr[i] = 1;
+    }
+    munmap(addr, size);
+    volatile uint64_t x = 0;
+    for (int i = 0; i < 10 * 1000 * 1000; ++i) {
+        x += i;
+    }
+}
+
+TEST(Perf, Phases)
+{
+    EXPECT_FALSE(util::perf::Read().valid);
+
+    setenv("LL_BOX_PERF", "1", 1);
+    ASSERT_EQ(util::perf::Open(), 0);
+    unsetenv("LL_BOX_PERF");
+    ASSERT_TRUE(util::perf::Enabled());
+
+    {
+        TRACE_SPAN("parent");
+        Work();
+    }
+
+    // the table is shared with child processes, which open their own counters
+    pid_t pid = fork();
+    if (pid == 0) {
+        {
+            TRACE_SPAN("child");
+            Work();
+        }
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+
+    {
+        TRACE_SPAN("parent");
+    }
+
+    std::ostringstream out;
+    util::perf::Report(out);
+    auto report = out.str();
+
+    std::istringstream lines(report);
+    std::string line;
+    std::getline(lines, line);
+    EXPECT_EQ(line.compare(0, 30, "ll-box counters by phase, from"), 0) << report;
+    std::getline(lines, line);
+
+    for (auto name : {"parent", "child"}) {
+        ASSERT_TRUE(std::getline(lines, line)) << report;
+        std::istringstream fields(line);
+        std::string phase;
+        uint64_t calls = 0;
+        double taskClock = 0;
+        std::string unit, cycles;
+        uint64_t pageFaults = 0;
+        fields >> phase >> calls >> taskClock >> unit >> cycles >> pageFaults;
+        EXPECT_EQ(phase, name);
+        EXPECT_EQ(calls, phase == "parent" ? 2 : 1);
+        EXPECT_GT(taskClock, 0) << line;
+        EXPECT_GT(pageFaults, 0) << line;
+    }
+}
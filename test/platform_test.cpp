@@ -0,0 +1,167 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "container/cgroup.h"
+#include "util/platform.h"
+
+using namespace linglong;
+
+static int ExitWith42(void *)
+{
+    return 42;
+}
+
+TEST(Platform, Clone3)
+{
+    int pidfd = -1;
+    int pid = util::PlatformClone3(ExitWith42, SIGCHLD, nullptr, -1, &pidfd);
+    if (pid < 0 && errno == ENOSYS) {
+        GTEST_SKIP() << "clone3 is not supported";
+    }
+    ASSERT_GT(pid, 0);
+    ASSERT_GE(pidfd, 0);
+
+    // pidfd becomes readable when the child exits
+    struct pollfd pfd = {pidfd, POLLIN, 0};
+    EXPECT_EQ(poll(&pfd, 1, 5000), 1);
+
+    int wstatus = 0;
+    ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+    EXPECT_TRUE(WIFEXITED(wstatus));
+    EXPECT_EQ(WEXITSTATUS(wstatus), 42);
+    close(pidfd);
+}
+
+TEST(Platform, SpawnExecError)
+{
+    util::SpawnArgs spawn({"ll-box-no-such-command"}, {"PATH=/nonexistent"}, "/");
+    int execErrno = 0;
+    int pid = util::Spawn(spawn, -1, nullptr, &execErrno);
+    ASSERT_GT(pid, 0);
+    EXPECT_EQ(execErrno, ENOENT);
+
+    int wstatus = 0;
+    ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+    EXPECT_TRUE(WIFEXITED(wstatus));
+    EXPECT_EQ(WEXITSTATUS(wstatus), 127);
+}
+
+TEST(Platform, SpawnSignalMask)
+{
+    // all signals are blocked around clone, the mask of the caller is restored
+    sigset_t mask;
+    sigset_t old;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    ASSERT_EQ(pthread_sigmask(SIG_BLOCK, &mask, &old), 0);
+
+    util::SpawnArgs spawn({"ll-box-no-such-command"}, {"PATH=/nonexistent"}, "/");
+    int pid = util::Spawn(spawn);
+    ASSERT_GT(pid, 0);
+    int wstatus = 0;
+    ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+
+    sigset_t current;
+    ASSERT_EQ(pthread_sigmask(SIG_SETMASK, &old, &current), 0);
+    EXPECT_EQ(sigismember(&current, SIGUSR1), 1);
+    EXPECT_EQ(sigismember(&current, SIGUSR2), sigismember(&old, SIGUSR2));
+}
+
+TEST(Platform, SpawnIntoCgroup)
+{
+    Cgroup cgroup;
+    if (0 != cgroup.Open("ll-box-test-spawn-" + std::to_string(getpid()))) {
+        GTEST_SKIP() << "no delegated cgroup v2";
+    }
+    if (access("/bin/sleep", X_OK) != 0) {
+        GTEST_SKIP() << "/bin/sleep is not found";
+    }
+
+    util::SpawnArgs spawn({"sleep", "10"}, {"PATH=/usr/bin:/bin"}, "/");
+    int pidfd = -1;
+    int execErrno = 0;
+    int pid = util::Spawn(spawn, cgroup.Fd(), &pidfd, &execErrno);
+    ASSERT_GT(pid, 0);
+    EXPECT_EQ(execErrno, 0);
+
+    // "0::/path" relative to the root of cgroup2
+    std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+    std::string line, path;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            path = line.substr(3);
+        }
+    }
+    EXPECT_FALSE(path.empty());
+    EXPECT_EQ(cgroup.Path().substr(cgroup.Path().size() - path.size()), path);
+
+    kill(pid, SIGKILL);
+    int wstatus = 0;
+    ASSERT_EQ(waitpid(pid, &wstatus, 0), pid);
+    EXPECT_TRUE(WIFSIGNALED(wstatus));
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    cgroup.Remove();
+}
+
+// throughput of util::Spawn, which the init loop starts processes with, compared with fork and execvpe it replaces.
+// The app cgroup of init is left out. Timing only, run it with
+// --gtest_also_run_disabled_tests
+TEST(Platform, DISABLED_SpawnBenchmark)
+{
+    const int count = 2000;
+    util::SpawnArgs spawn({"true"}, {"PATH=/usr/bin:/bin"}, "/");
+    if (access("/bin/true", X_OK) != 0) {
+        GTEST_SKIP() << "/bin/true is not found";
+    }
+
+    auto run = [&](bool vfork) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i) {
+            int pid = -1;
+            if (vfork) {
+                int pidfd = -1;
+                int execErrno = 0;
+                pid = util::Spawn(spawn, -1, &pidfd, &execErrno);
+                if (pidfd >= 0) {
+                    close(pidfd);
+                }
+            } else {
+                pid = fork();
+                if (pid == 0) {
+                    execvpe(spawn.argv[0], spawn.argv.data(), spawn.envp.data());
+                    _exit(127);
+                }
+            }
+            EXPECT_GT(pid, 0);
+            int wstatus = 0;
+            EXPECT_EQ(waitpid(pid, &wstatus, 0), pid);
+            EXPECT_TRUE(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        return count / elapsed.count();
+    };
+
+    auto forkRate = run(false);
+    auto spawnRate = run(true);
+    RecordProperty("fork_per_second", static_cast<int>(forkRate));
+    RecordProperty("spawn_per_second", static_cast<int>(spawnRate));
+    std::cout << "fork+execvpe: " << static_cast<int>(forkRate) << "/s, spawn: " << static_cast<int>(spawnRate) << "/s"
+              << std::endl;
+}
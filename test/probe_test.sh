@@ -0,0 +1,18 @@
+#!/bin/sh
+# check the USDT probes of src/util/probe.h are in the ELF notes of a ll-box binary
+# usage: probe_test.sh <readelf> <binary>
+
+notes=$("$1" -n "$2") || exit 1
+
+for probe in start__start entry__cloned start__done entry__start entry__mounted entry__pivoted init__cloned \
+    init__start seccomp__start seccomp__done init__ready exec mount__start mount__done; do
+    if ! echo "$notes" | grep -q "Name: ${probe}\$"; then
+        echo "probe ll_box:${probe} is missing in $2"
+        exit 1
+    fi
+done
+
+if ! echo "$notes" | grep -q "Provider: ll_box"; then
+    echo "provider ll_box is missing in $2"
+    exit 1
+fi
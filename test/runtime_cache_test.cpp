@@ -0,0 +1,100 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "util/oci_runtime.h"
+#include "util/runtime_cache.h"
+
+using namespace linglong;
+
+static std::string readFile(const std::string &filepath)
+{
+    std::ifstream f(filepath);
+    return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+TEST(RuntimeCache, RoundTrip)
+{
+    for (auto name : {"config.json", "app-wine-bundle.json", "config-seccomp.json", "app-flatpak.json"}) {
+        auto content = readFile(std::string("../../test/data/demo/") + name);
+        auto r = fromString(content);
+
+        auto data = util::RuntimeCache::Encode(content, r);
+        Runtime decoded;
+        ASSERT_TRUE(util::RuntimeCache::Decode(data.c_str(), data.size(), content, decoded)) << name;
+
+        nlohmann::json expected = r, actual = decoded;
+        EXPECT_EQ(actual, expected) << name;
+
+        // flags and type are not in json
+        ASSERT_EQ(decoded.mounts.has_value(), r.mounts.has_value());
+        for (size_t i = 0; r.mounts.has_value() && i < r.mounts->size(); ++i) {
+            EXPECT_EQ(decoded.mounts->at(i).flags, r.mounts->at(i).flags);
+            EXPECT_EQ(decoded.mounts->at(i).fsType, r.mounts->at(i).fsType);
+        }
+
+        // another json or a truncated file is a miss
+        EXPECT_FALSE(util::RuntimeCache::Decode(data.c_str(), data.size(), content + " ", decoded));
+        EXPECT_FALSE(util::RuntimeCache::Decode(data.c_str(), data.size() - 1, content, decoded));
+    }
+}
+
+TEST(RuntimeCache, LoadStore)
+{
+    char dir[] = "/tmp/ll-box-cache-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    auto content = readFile("../../test/data/demo/config-mini.json");
+    util::RuntimeCache cache(dir);
+    Runtime r;
+
+    EXPECT_FALSE(cache.Load(content, r));
+    EXPECT_EQ(cache.Store(content, fromString(content)), 0);
+    ASSERT_TRUE(cache.Load(content, r));
+    EXPECT_EQ(r.process.args[0], "/bin/bash");
+
+    unlink(util::format("%s/%016llx.bin", dir, static_cast<unsigned long long>(util::RuntimeCache::Hash(content)))
+               .c_str());
+    rmdir(dir);
+}
+
+TEST(RuntimeCache, PruneOwnFiles)
+{
+    char dir[] = "/tmp/ll-box-cache-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    // the seccomp cache and anything else in the dir are not pruned
+    auto other = util::format("%s/seccomp-0000000000000000.bpf", dir);
+    close(open(other.c_str(), O_WRONLY | O_CREAT, 0600));
+
+    auto content = readFile("../../test/data/demo/config-mini.json");
+    util::RuntimeCache cache(dir);
+    std::vector<std::string> contents;
+    for (int i = 0; i < 65; ++i) {
+        contents.push_back(content + std::string(static_cast<size_t>(i), ' '));
+        EXPECT_EQ(cache.Store(contents.back(), fromString(content)), 0);
+    }
+
+    EXPECT_EQ(access(other.c_str(), F_OK), 0);
+    size_t cached = 0;
+    for (auto const &c : contents) {
+        auto path = util::format("%s/%016llx.bin", dir, static_cast<unsigned long long>(util::RuntimeCache::Hash(c)));
+        if (0 == access(path.c_str(), F_OK)) {
+            ++cached;
+            unlink(path.c_str());
+        }
+    }
+    EXPECT_EQ(cached, 64u);
+
+    unlink(other.c_str());
+    EXPECT_EQ(rmdir(dir), 0);
+}
@@ -9,8 +9,12 @@
 #include <seccomp.h>
 
 #include <sys/klog.h>
+#include <sys/wait.h>
+#include <dirent.h>
 #include <climits>
 
+#include <chrono>
+
 #include "util/oci_runtime.h"
 
 #include "container/seccomp.h"
@@ -60,3 +64,82 @@ TEST(OCI, SeccompDefault)
     klogctl(2, buf, bufSize);
     EXPECT_EQ(errno, EPERM);
 }
+
+// remove a cache dir made by mkdtemp
+static void RemoveCacheDir(const char *dir)
+{
+    auto d = opendir(dir);
+    while (auto entry = readdir(d)) {
+        unlinkat(dirfd(d), entry->d_name, 0);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+TEST(OCI, SeccompCache)
+{
+    char dir[] = "/tmp/ll-box-seccomp-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    auto r = linglong::fromFile("../../test/data/demo/config-seccomp-default.json");
+    std::vector<struct sock_filter> fresh, cached;
+
+    // built with libseccomp, then stored and read back from the cache
+    EXPECT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, "", fresh), 0);
+    EXPECT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, dir, cached), 0);
+    EXPECT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, dir, cached), 0);
+
+    ASSERT_FALSE(fresh.empty());
+    ASSERT_EQ(fresh.size(), cached.size());
+    EXPECT_EQ(0, memcmp(fresh.data(), cached.data(), fresh.size() * sizeof(struct sock_filter)));
+
+    // the cached program works as seccomp_load does, try it in a child
+    r = linglong::fromFile("../../test/data/demo/config-seccomp.json");
+    ASSERT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, dir, cached), 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char buf[PATH_MAX];
+        if (linglong::LoadSeccompProgram(cached) != 0) {
+            _exit(1);
+        }
+        _exit(getcwd(buf, sizeof(buf)) == nullptr && errno == EPERM ? 0 : 2);
+    }
+    int wstatus = -1;
+    waitpid(pid, &wstatus, 0);
+    EXPECT_TRUE(WIFEXITED(wstatus));
+    EXPECT_EQ(WEXITSTATUS(wstatus), 0);
+
+    RemoveCacheDir(dir);
+}
+
+// timing only, run it with --gtest_also_run_disabled_tests
+TEST(OCI, DISABLED_SeccompCacheBenchmark)
+{
+    char dir[] = "/tmp/ll-box-seccomp-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    auto r = linglong::fromFile("../../test/data/demo/config-seccomp-default.json");
+    std::vector<struct sock_filter> program;
+
+    // cold: build with libseccomp, warm: read from cache
+    const int rounds = 20;
+    std::chrono::steady_clock::duration cold {}, warm {};
+    for (int i = 0; i < rounds; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        EXPECT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, "", program), 0);
+        cold += std::chrono::steady_clock::now() - begin;
+    }
+    EXPECT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, dir, program), 0);
+    for (int i = 0; i < rounds; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        EXPECT_EQ(linglong::PrepareSeccomp(r.linux.seccomp, dir, program), 0);
+        warm += std::chrono::steady_clock::now() - begin;
+    }
+
+    auto us = [&](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / rounds;
+    };
+    std::cout << "prepare seccomp: cold " << us(cold) << "us, warm " << us(warm) << "us" << std::endl;
+
+    RemoveCacheDir(dir);
+}
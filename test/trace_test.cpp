@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "util/util.h"
+#include "util/trace.h"
+#include "util/trace_ring.h"
+
+using namespace linglong;
+
+TEST(Trace, Span)
+{
+    char dir[] = "/tmp/ll-box-trace-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    EXPECT_FALSE(util::trace::Enabled());
+    ASSERT_EQ(util::trace::Open(dir), 0);
+    EXPECT_TRUE(util::trace::Enabled());
+
+    {
+        TRACE_SPAN("parent", "/usr");
+    }
+
+    // events of child processes go to the same file
+    pid_t pid = fork();
+    if (pid == 0) {
+        util::trace::Instant("child");
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+
+    std::string file;
+    auto d = opendir(dir);
+    while (auto entry = readdir(d)) {
+        if (entry->d_name[0] != '.') {
+            file = util::format("%s/%s", dir, entry->d_name);
+        }
+    }
+    closedir(d);
+    ASSERT_FALSE(file.empty());
+
+    std::ifstream f(file);
+    std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    // the array is left open, close it to parse
+    auto events = util::json::fromByteArray(content.substr(0, content.rfind(',')) + "]");
+
+    ASSERT_EQ(events.size(), 2);
+    EXPECT_EQ(events[0]["name"], "parent");
+    EXPECT_EQ(events[0]["ph"], "X");
+    EXPECT_EQ(events[0]["args"]["detail"], "/usr");
+    EXPECT_EQ(events[1]["name"], "child");
+    EXPECT_EQ(events[1]["tid"], pid);
+    EXPECT_EQ(events[0]["pid"], events[1]["pid"]);
+    EXPECT_LE(events[0]["ts"].get<uint64_t>(), events[1]["ts"].get<uint64_t>());
+
+    unlink(file.c_str());
+    rmdir(dir);
+}
+
+TEST(Trace, Ring)
+{
+    char dir[] = "/tmp/ll-box-ring-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    ASSERT_EQ(util::trace::OpenRing(dir), 0);
+    util::trace::Record(util::trace::kMountPlan, 7, 51);
+
+    // the mapping is shared with child processes
+    pid_t pid = fork();
+    if (pid == 0) {
+        util::trace::Record(util::trace::kExec, 2, 0);
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+
+    auto path = util::format("%s/ll-box-%d.ring", dir, getpid());
+    std::ostringstream out;
+    ASSERT_EQ(util::trace::DumpRing(path, out), 0);
+
+    auto dump = out.str();
+    EXPECT_NE(dump.find("3 events"), std::string::npos) << dump;
+    auto launch = dump.find("launch");
+    auto plan = dump.find("mount-plan");
+    EXPECT_NE(dump.find(" 7 51\n"), std::string::npos) << dump;
+    auto exec = dump.find(util::format("pid %-6d exec", pid));
+    EXPECT_NE(launch, std::string::npos) << dump;
+    EXPECT_NE(plan, std::string::npos) << dump;
+    EXPECT_NE(exec, std::string::npos) << dump;
+    EXPECT_LT(launch, plan);
+    EXPECT_LT(plan, exec);
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,173 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <functional>
+
+#include "container/zygote.h"
+#include "util/util.h"
+
+using namespace linglong;
+
+// a container which echoes the process it gets and the next message, and logs its pid to spawnLog when it's forked
+static int spawnLog = -1;
+
+static int Launch(const Runtime &runtime, std::unique_ptr<util::MessageReader> reader, const Option &)
+{
+    auto line = util::format("%d\n", getpid());
+    if (write(spawnLog, line.c_str(), line.size()) < 0) {
+        return -1;
+    }
+    auto process = reader->read();
+    reader->write(
+        nlohmann::json({{"pid", getpid()}, {"process", process}, {"cgroupsPath", runtime.linux.cgroupsPath}}).dump());
+    auto next = reader->read();
+    reader->write(nlohmann::json({{"pid", getpid()}, {"next", next}}).dump());
+    return 0;
+}
+
+static pid_t WaitSpawn(int fd)
+{
+    std::string line;
+    char c;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, 5000) == 1 && read(fd, &c, 1) == 1 && c != '\n') {
+        line.push_back(c);
+    }
+    return line.empty() ? -1 : std::stoi(line);
+}
+
+static int RecvFd(int socket)
+{
+    char payload = 0;
+    struct iovec iov = {&payload, sizeof(payload)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(socket, &msg, 0) != 1 || payload != 'o') {
+        return -1;
+    }
+    int fd = -1;
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return fd;
+}
+
+static int Connect(const std::string &path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    for (int i = 0; i < 500 && 0 != connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)); ++i) {
+        usleep(10 * 1000);
+    }
+    return fd;
+}
+
+// send a request, return the pid of the container which served it. The request is written in two parts if split.
+static pid_t Request(const std::string &path,
+                     nlohmann::json config,
+                     const std::string &arg,
+                     const std::function<void()> &split = nullptr)
+{
+    util::MessageReader client(Connect(path));
+    config["process"]["args"] = {arg};
+    if (split) {
+        auto data = config.dump();
+        auto half = data.substr(0, data.size() / 2);
+        EXPECT_EQ(write(client.fd, half.c_str(), half.size()), static_cast<ssize_t>(half.size()));
+        split();
+        client.write(data.substr(half.size()));
+    } else {
+        client.write(config.dump());
+    }
+
+    util::MessageReader container(RecvFd(client.fd));
+    auto echo = container.read();
+    EXPECT_EQ(echo["process"]["args"][0], arg);
+    // a cgroup of its own
+    EXPECT_EQ(echo["cgroupsPath"], util::format("%s-%d", config["linux"]["cgroupsPath"].get<std::string>().c_str(),
+                                                echo["pid"].get<pid_t>()));
+    // the process is framed once, the next message is not an empty one left by it
+    container.write(R"({"type":"next"})");
+    EXPECT_EQ(container.read()["next"]["type"], "next");
+    return echo["pid"].get<pid_t>();
+}
+
+TEST(Zygote, Request)
+{
+    char dir[] = "/tmp/ll-box-zygote-XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    auto path = std::string(dir) + "/zygote.sock";
+
+    std::ifstream file("../../test/data/demo/config-mini.json");
+    auto config = nlohmann::json::parse(file);
+
+    int log[2];
+    ASSERT_EQ(pipe(log), 0);
+    pid_t server = fork();
+    if (server == 0) {
+        close(log[0]);
+        spawnLog = log[1];
+        Zygote zygote(path, 1, Option(), Launch);
+        _exit(zygote.Serve());
+    }
+    close(log[1]);
+
+    // the pool is empty, a cold container serves it and the pool is refilled after the reply. Both are forked by then,
+    // they may log in either order.
+    auto cold = Request(path, config, "/bin/first");
+    auto first = WaitSpawn(log[0]);
+    auto second = WaitSpawn(log[0]);
+    EXPECT_TRUE(first == cold || second == cold);
+    auto warm = first == cold ? second : first;
+    EXPECT_GT(warm, 0);
+    EXPECT_NE(warm, cold);
+
+    // the same config but process takes the warm one
+    EXPECT_EQ(Request(path, config, "/bin/second"), warm);
+    EXPECT_GT(WaitSpawn(log[0]), 0);
+
+    // another config has a pool of its own
+    config["hostname"] = "other";
+    auto other = Request(path, config, "/bin/third");
+    first = WaitSpawn(log[0]);
+    second = WaitSpawn(log[0]);
+    EXPECT_TRUE(first == other || second == other);
+    EXPECT_NE(other, warm);
+
+    // a client which sent half of its request does not hold up another one
+    pid_t served = -1;
+    auto slow = Request(path, config, "/bin/slow", [&]() { served = Request(path, config, "/bin/fast"); });
+    EXPECT_GT(served, 0);
+    EXPECT_NE(slow, served);
+
+    kill(server, SIGTERM);
+    int status = -1;
+    waitpid(server, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(log[0]);
+    unlink(path.c_str());
+    rmdir(dir);
+}